@@ -1,328 +1,487 @@
 #include "MIDIUSB.h"
 #include "ArpEffect.h"
 #include "Utils.h"
-#include <EEPROM.h>
+#include "NoteTracker.h"
+#include "TapTempo.h"
+#include "Settings.h"
 
 /* BEGIN ARPLIST CLASS */
 ArpList::ArpList() {
   size = 0;
-  noteIdx = 0;
-  stepIdx = 0;
+  usedSlots = 0;
+  playingSlots = 0;
+  for (uint8_t i = 0; i < 128; i++) {
+    slotOf[i] = ARP_NO_SLOT;
+  }
 
-  prevNoteIdx = -1;
-  prevStepIdx = -1;
-  directionFlag = 1;
+  seqLength = 0;
+  seqIdx = 0;
+  stepWidth = 1;
+  stepIdx = 0;
+  isHoldMode = false;
+  retriggerAll = false;
 
   playMode = playModes[0];
+  playModeIdx = 0;
+
+  lastStart = 0;
+  lastWidth = 0;
 
-  // Set all steps on as default
+  // Steps saved as on/off read as 1/0, anything out of range plays normally
   for (int i = 0; i < 16; i++) {
-    stepList[i] = EEPROM.read(EEPROM_ARP_BASE + i);
+    stepList[i] = settings.getArpStep(i);
+    if (stepList[i] > ARP_MAX_RATCHETS) stepList[i] = 1;
   }
 }
 
-void ArpList::add(midi::DataByte note, midi::DataByte velocity,
+bool ArpList::add(midi::DataByte note, midi::DataByte velocity,
                    midi::DataByte channel) {
-  ArpNote_t n = {};
+  if (note > 127) {
+    return false;
+  }
+
+  // The same pitch again just updates the held note
+  uint8_t slot = slotOf[note];
+  bool isNew = slot == ARP_NO_SLOT;
+  if (isNew) {
+    if (size >= NOTE_BUFFER_SIZE) {
+      return false; // Full, ignore the note
+    }
+
+    slot = __builtin_ctzl(~usedSlots); // Lowest free slot
+    usedSlots |= 1UL << slot;
+    slotOf[note] = slot;
+    heldPitches.set(note);
+    playOrder[size] = slot;
+    size++;
+    notes[slot].playing = ARP_NOT_PLAYING;
+  }
+
+  ArpNote_t &n = notes[slot];
   n.note = note;
   n.velocity = velocity;
   n.channel = channel;
-  n.lastOctave = 0;
-  n.currOctave = 0; // Offset for octave since we do note + (currOctave * 12)
-  
-
-  // When inserting a new note, default to note order ascending,
-  // But if the current play mode is as-played, insert in order of play
-  switch (playMode.direction) {
-    case AP: // Insert at the next available space
-      noteList[size] = n;
-      break;
-    case RAND: // Insert at the next available space
-      noteList[size] = n;
-      break;
-    default: // Insert in note order lowest -> highest
-      uint8_t i;
-      for (i = 0; i < size; i++) {
-
-        // If the note is bigger, insert at that spot
-        if (noteList[i].note > n.note) {
-
-          // If the current note falls within the shifted notes, we need to shift
-          // The current indices up as well
-          if (noteIdx >= i) {
-            noteIdx++;
-          } if (prevNoteIdx >= i) {
-            prevNoteIdx++;
-          }
-
-          // Shift all notes up 
-          for (uint8_t j = size; j > i; j--) {
-            noteList[j] = noteList[j-1];
-          }
-          break;
-        }
-      }
+  n.isReleased = false;
 
-      // Insert the new note
-      noteList[i] = n;
-      break;
+  if (isNew) {
+    compile();
   }
-  size++;
+  return true;
 }
 
 void ArpList::del(midi::DataByte note) {
-  // Search through list to find note 
-  for (uint8_t i = 0; i < size; i++) {
-
-    // If note found, shift all entries down
-    if (noteList[i].note == note) {
-
-      // Turn off the note first (handles octaves)
-      sendMidiBoth(midi::MidiType::NoteOff, noteList[i].note + (noteList[i].lastOctave * 12), noteList[i].velocity,
-                 noteList[i].channel);
-      for (uint8_t j = i; j < size; j++) {
-        noteList[j] = noteList[j + 1];
-      }
-      size--;
-
-      // If the current note is within the shifted notes,
-      // shift the indices too
-      if (prevNoteIdx > i) prevNoteIdx--;
-      if (noteIdx > i) noteIdx--;
-
-      // Reset to defaults if no notes are being held
-      if (size == 0) {
-        noteIdx = 0;
-        stepIdx = 0;
-        prevNoteIdx = -1;
-        prevStepIdx = -1;
-
-        // Set the play mode to default for up/down mode
-        // NOTE: Just up/down as others don't change direction
-        if (playMode.direction == UPDOWN) {
-          directionFlag = 1;
-        }
-      }
-      break; // Stop the loop since the note has been found
-    }
+  if (note > 127 || slotOf[note] == ARP_NO_SLOT) {
+    return;
   }
-}
-
-uint8_t ArpList::getSize() { return size; }
+  uint8_t slot = slotOf[note];
 
-uint8_t ArpList::getOctaves() { return playMode.octaveSpan; }
+  // Turn off the note first (handles octaves)
+  releaseSlot(slot);
 
-int8_t ArpList::getDirFlag() { return directionFlag; }
+  slotOf[note] = ARP_NO_SLOT;
+  heldPitches.reset(note);
+  usedSlots &= ~(1UL << slot);
 
-ArpNote_t *ArpList::getPrevNote() {
-  if (size == 0 || prevNoteIdx == -1 || !stepList[prevStepIdx]) {
-    return nullptr;
+  // Close the gap in the play order
+  uint8_t i = 0;
+  while (playOrder[i] != slot) {
+    i++;
+  }
+  size--;
+  for (; i < size; i++) {
+    playOrder[i] = playOrder[i + 1];
   }
 
-  return &noteList[prevNoteIdx];
+  // Reset to defaults if no notes are being held
+  if (size == 0) {
+    stepIdx = 0;
+    seqIdx = 0;
+  }
+  compile();
 }
 
-ArpNote_t *ArpList::getNote() {
-
-  if (!stepList[stepIdx] || size == 0) {
-    stepIdx = (stepIdx + 1) % 16; // Don't forget to increment step index before return
-    return nullptr;
+void ArpList::append(uint8_t slot, int8_t octave) {
+  // Pull the octave back in if it takes the note out of midi range
+  int16_t pitch = notes[slot].note + octave * 12;
+  while (pitch > 127) {
+    octave--;
+    pitch -= 12;
   }
+  while (pitch < 0) {
+    octave++;
+    pitch += 12;
+  }
+  sequence[seqLength++] = slot | ((uint8_t)octave << ARP_OCTAVE_SHIFT);
+}
 
-  // 1. Get the current note
-  ArpNote_t *note = &noteList[noteIdx];
-  prevNoteIdx = noteIdx;
-  prevStepIdx = stepIdx;
+void ArpList::compile() {
+  seqLength = 0;
+  lastWidth = 0;
+  stepWidth = playMode.chordMode ? size : 1;
+  if (size == 0) {
+    return;
+  }
 
-  // 2. Choose the next note index based on the current play mode
+  // The order of the notes within one octave
+  uint8_t order[NOTE_BUFFER_SIZE];
+  uint8_t n = 0;
   switch (playMode.direction) {
   case AP:
-    noteIdx = (noteIdx + 1) % size;
+    for (; n < size; n++) {
+      order[n] = playOrder[n];
+    }
     break;
-  case UP:
-    noteIdx = (noteIdx + 1) % size;
+  case DOWN: // Highest -> lowest
+    for (int16_t p = heldPitches.prev(127); p != -1; p = p > 0 ? heldPitches.prev(p - 1) : -1) {
+      order[n++] = slotOf[p];
+    }
     break;
-  case DOWN:
-    if (noteIdx == 0) {
-    noteIdx = size - 1;
-    } else {
-      noteIdx = (noteIdx - 1);
+  default: // Lowest -> highest
+    for (int16_t p = heldPitches.next(0); p != -1; p = heldPitches.next(p + 1)) {
+      order[n++] = slotOf[p];
     }
     break;
-  case UPDOWN:
-    // Wrap around if we aren't at the first octave
-    if (noteIdx == 0) {
-      directionFlag = 1;
-    } else if (noteIdx+1 >= size) {
-      directionFlag = -1;
+  }
+
+  // Play through the notes once per octave, down goes down the octaves
+  int8_t octaveDir = playMode.direction == DOWN ? -1 : 1;
+  for (uint8_t oct = 0; oct < playMode.octaveSpan && oct < ARP_MAX_OCTAVES; oct++) {
+    for (uint8_t i = 0; i < n; i++) {
+      append(order[i], oct * octaveDir);
+    }
+  }
+
+  // A new shuffle starts from the beginning
+  if (playMode.direction == SHUFFLE) {
+    seqIdx = 0;
+  }
+
+  // Up/down plays back down without repeating the top and bottom notes
+  if (playMode.direction == UPDOWN) {
+    for (int16_t i = seqLength - 2; i > 0; i--) {
+      sequence[seqLength++] = sequence[i];
     }
+  }
 
-    // Proceed to the next step with the direction flag
-    noteIdx = (noteIdx + directionFlag);
-    break;
-  case RAND:
-    noteIdx = random(0, size);
-    break;
+  // Carry on from the same place, as long as it's still the start of a step
+  if (seqIdx >= seqLength || seqIdx % stepWidth != 0) {
+    seqIdx = 0;
+  }
+}
+
+void ArpList::shuffle() {
+  uint8_t last = sequence[lastStart];
+
+  // Fisher-Yates
+  for (uint8_t i = seqLength - 1; i > 0; i--) {
+    uint8_t j = rng.below(i + 1);
+    uint8_t entry = sequence[i];
+    sequence[i] = sequence[j];
+    sequence[j] = entry;
   }
-  
-  // 3. Increment the step index
+
+  // Don't play the same note twice in a row across cycles
+  if (lastWidth > 0 && seqLength > 1 && sequence[0] == last) {
+    uint8_t j = 1 + rng.below(seqLength - 1);
+    sequence[0] = sequence[j];
+    sequence[j] = last;
+  }
+}
+
+void ArpList::seedRandom(uint32_t seed) {
+  rng.seed(seed);
+}
+
+uint8_t ArpList::entryPitch(uint8_t entry) {
+  int8_t octave = (int8_t)entry >> ARP_OCTAVE_SHIFT;
+  return notes[entry & ARP_SLOT_MASK].note + octave * 12;
+}
+
+void ArpList::playEntry(uint8_t entry, Pos_t offPos) {
+  uint8_t slot = entry & ARP_SLOT_MASK;
+  ArpNote_t &n = notes[slot];
+
+  // Retriggering a note that's still playing ends it first
+  releaseSlot(slot);
+
+  n.playing = entryPitch(entry);
+  playingSlots |= 1UL << slot;
+  gates.schedule(slot, offPos);
+  sendMidiBoth(midi::MidiType::NoteOn, n.playing, n.velocity, n.channel);
+}
+
+void ArpList::releaseSlot(uint8_t slot) {
+  ArpNote_t &n = notes[slot];
+  if (playingSlots & (1UL << slot)) {
+    sendMidiBoth(midi::MidiType::NoteOff, n.playing, n.velocity, n.channel);
+    n.playing = ARP_NOT_PLAYING;
+    playingSlots &= ~(1UL << slot);
+    gates.cancel(slot);
+  }
+}
+
+void ArpList::releaseDue(Pos_t pos) {
+  int16_t slot;
+  while ((slot = gates.popDue(pos)) != -1) {
+    releaseSlot(slot);
+  }
+}
+
+void ArpList::releasePlaying() {
+  while (playingSlots) {
+    releaseSlot(__builtin_ctzl(playingSlots));
+  }
+}
+
+bool ArpList::playStep(Pos_t offPos) {
+  bool isPlayed = stepList[stepIdx] && seqLength > 0;
   stepIdx = (stepIdx + 1) % 16; // Go to next step
-  return note;
+
+  if (!isPlayed) {
+    lastWidth = 0;
+    releasePlaying();
+    return false;
+  }
+
+  if (playMode.direction == RAND) {
+    lastStart = rng.below(seqLength);
+    lastWidth = 1;
+  } else {
+    if (playMode.direction == SHUFFLE && seqIdx == 0) {
+      shuffle();
+    }
+    lastStart = seqIdx;
+    lastWidth = stepWidth;
+    seqIdx += stepWidth;
+    if (seqIdx >= seqLength) {
+      seqIdx = 0;
+    }
+  }
+
+  voiceStep(offPos);
+  return true;
 }
 
-ArpNote_t *ArpList::getNoteAt(uint8_t pos) {
-  if (!stepList[stepIdx]) {
-    return nullptr;
+void ArpList::voiceStep(Pos_t offPos) {
+  uint32_t keep = 0; // Slots that carry on playing the same pitch
+
+  // In chord mode, notes already playing the right pitch just carry on
+  if (playMode.chordMode && !retriggerAll) {
+    for (uint8_t i = 0; i < lastWidth; i++) {
+      uint8_t entry = sequence[lastStart + i];
+      uint8_t slot = entry & ARP_SLOT_MASK;
+      if ((playingSlots & (1UL << slot)) && notes[slot].playing == entryPitch(entry)) {
+        keep |= 1UL << slot;
+        gates.schedule(slot, offPos);
+      }
+    }
+  }
+
+  // Everything else the previous step played ends now
+  uint32_t ending = playingSlots & ~keep;
+  while (ending) {
+    uint8_t slot = __builtin_ctzl(ending);
+    releaseSlot(slot);
+    ending &= ~(1UL << slot);
+  }
+
+  for (uint8_t i = 0; i < lastWidth; i++) {
+    uint8_t entry = sequence[lastStart + i];
+    if (!(keep & (1UL << (entry & ARP_SLOT_MASK)))) {
+      playEntry(entry, offPos);
+    }
+  }
+}
+
+void ArpList::retrigger(Pos_t offPos) {
+  for (uint8_t i = 0; i < lastWidth; i++) {
+    playEntry(sequence[lastStart + i], offPos);
   }
-  return &noteList[pos];
 }
 
+uint8_t ArpList::getSize() { return size; }
+
 ArpNote_t *ArpList::getNoteFromPitch(midi::DataByte note) {
-  for (uint8_t i = 0; i < size; i++) {
-    if (noteList[i].note == note) {
-      return &noteList[i];
-    }
+  if (note > 127 || slotOf[note] == ARP_NO_SLOT) {
+    return nullptr;
   }
-  return nullptr;
+  return &notes[slotOf[note]];
 }
 
 bool ArpList::inHoldMode() {
   return isHoldMode;
 }
 
+void ArpList::setRetriggerAll(bool state) { retriggerAll = state; }
+
+bool ArpList::getRetriggerAll() { return retriggerAll; }
+
 bool ArpList::allNotesReleased() {
   for (uint8_t i = 0; i < size; i++) {
-    if (!noteList[i].isReleased) {
+    if (!notes[playOrder[i]].isReleased) {
       return false;
     }
   }
   return true;
 }
 
-void ArpList::toggleStep(uint8_t index) { 
-  stepList[index] = !stepList[index];
-  EEPROM.write(EEPROM_ARP_BASE + index, stepList[index]);
+void ArpList::cycleStep(uint8_t index) { 
+  setStep(index, (stepList[index] + 1) % (ARP_MAX_RATCHETS + 1));
 }
 
-bool ArpList::getStep(uint8_t index) { return stepList[index]; }
+uint8_t ArpList::getStep(uint8_t index) { return stepList[index]; }
 
-void ArpList::setPlayMode(uint8_t pos) {
-  if (playMode.chordMode) {
-    for (uint8_t i = 0; i < size; i++) {
-      sendMidiBoth(midi::MidiType::NoteOff, noteList[i].note + (noteList[i].lastOctave * 12), noteList[i].velocity, noteList[i].channel);
-    }
-  }
+void ArpList::setStep(uint8_t index, uint8_t ratchets) {
+  if (ratchets > ARP_MAX_RATCHETS) return;
+  stepList[index] = ratchets;
+  settings.setArpStep(index, ratchets);
+}
 
-  if (pos < NUM_PLAYMODE) {
-    playMode = playModes[pos];
+uint8_t ArpList::getStepIdx() { return stepIdx; }
 
-    if (playMode.direction == AP || 
-        playMode.direction == UP || 
-        playMode.direction == UPDOWN ||
-        playMode.direction == RAND
-    ) {
-      directionFlag = 1;
-    } else {
-      directionFlag = -1;
+void ArpList::locate(uint32_t step) {
+  stepIdx = step % 16;
+
+  // Muted steps don't move through the sequence, so count the played ones
+  uint8_t perCycle = 0;
+  uint8_t beforeStep = 0;
+  for (uint8_t i = 0; i < 16; i++) {
+    if (stepList[i]) {
+      perCycle++;
+      if (i < stepIdx) beforeStep++;
     }
   }
+
+  uint32_t played = (step / 16) * perCycle + beforeStep;
+  seqIdx = seqLength > 0 ? (played * stepWidth) % seqLength : 0;
+  if (seqIdx % stepWidth != 0) {
+    seqIdx = 0;
+  }
 }
 
-void ArpList::incrementStep() {
-  stepIdx = (stepIdx + 1) % 16;
+void ArpList::setPlayMode(uint8_t pos) {
+  if (pos < NUM_PLAYMODE) {
+    playMode = playModes[pos];
+    playModeIdx = pos;
+    compile();
+  }
 }
 
-bool ArpList::isChordMode() {
-  return playMode.chordMode;
-};
+uint8_t ArpList::getPlayMode() { return playModeIdx; }
 
 void ArpList::clear() {
+  // Only the notes that are actually sounding get a note off
+  releasePlaying();
   for (uint8_t i = 0; i < size; i++) {
-    ArpNote_t n = noteList[noteIdx];
-    sendMidiBoth(midi::MidiType::NoteOff, n.note + (n.lastOctave * 12), n.velocity, n.channel);
+    slotOf[notes[playOrder[i]].note] = ARP_NO_SLOT;
   }
 
-  // HACK: This fixes hanging note on hold mode for some reason
-  ArpNote_t n = noteList[prevNoteIdx];
-  sendMidiBoth(midi::MidiType::NoteOff, n.note + (n.lastOctave * 12), n.velocity, n.channel);
-
+  heldPitches.clear();
+  usedSlots = 0;
   size = 0;
-  noteIdx = 0;
   stepIdx = 0;
-  prevNoteIdx = -1;
-  prevStepIdx = -1;
+  seqIdx = 0;
+  seqLength = 0;
 }
 /* END ARPLIST CLASS */
 
 
 ArpEffect::ArpEffect() {
-  inProgramMode = false;
-  lastClockMs = 0;
-  clockCount = 0;
+  mode = ARPMODE_DEFAULT;
   clocksPerStep = 6; // 6 = 1/16, 12 = 1/4
-  extTapIntervalsMs[0] = 500;
-  extTapIntervalsMs[1] = 500;
-  lastExtTapMs = 0;
-  extClockIntervalMs = 125; // 500/4 = 125 
-  lastExtClockMs = 0;
+  stepLength = clocksPerStep * POS_PER_PULSE;
+  clockLedOn = false;
   isInitialised = false;
+  isStompActive = false; // The pedal boots inactive
+  isTransportStopped = transport.isStopped();
+
+  uint8_t savedGate = settings.getArpGate();
+  gate = savedGate < NUM_ARP_GATES ? savedGate : DEFAULT_ARP_GATE;
+  uint8_t savedSwing = settings.getArpSwing();
+  setSwing(savedSwing < NUM_ARP_SWINGS ? savedSwing : 0);
+
+  arpList.setRetriggerAll(settings.getArpRetrigger());
+
+  // A different random run each time the arp starts
+  arpList.seedRandom(nowTicks());
+
+  tapTempo.begin();
+
+  resyncSteps(timebase.getPosition(nowTicks()));
+}
+
+void ArpEffect::setSwing(uint8_t amount) {
+  swing = amount;
+  swingOffset = stepLength * swing / ARP_SWING_DIVISOR;
+}
+
+Pos_t ArpEffect::getGateLength(Pos_t length) {
+  return (length * ARP_GATES[gate]) >> 8;
+}
+
+void ArpEffect::resyncSteps(Pos_t pos) {
+  // Line the steps up with the clock pulses again
+  gridPos = pos - (pos % stepLength) + stepLength;
+  nextEventPos = gridPos;
+  ratchetLength = stepLength;
+  ratchetNum = 0;
+  ratchetCount = 1;
 }
 
-void ArpEffect::advanceArpStep() {
+void ArpEffect::startStep() {
+  // The off beat steps are pushed later by the swing, so they're shorter
+  uint8_t stepIdx = arpList.getStepIdx();
+  Pos_t length = (stepIdx & 1) ? stepLength - swingOffset : stepLength + swingOffset;
+
+  ratchetCount = 1;
   if (isStompActive) {
-    if (arpList.isChordMode()) {
-      uint8_t i = 0;
-      while (i < arpList.getSize()) {
-        ArpNote_t *n = arpList.getNoteAt(i);
-        if (n == nullptr) {
-          break;
-        }
-
-        // Safety for making sure the octave is within range
-        checkOctaveBounds(n);
-
-        sendMidiBoth(midi::MidiType::NoteOff, n->note + (n->lastOctave * 12), n->velocity, n->channel);
-        sendMidiBoth(midi::MidiType::NoteOn, n->note + (n->currOctave * 12), n->velocity, n->channel);
-        n->lastOctave = n->currOctave;
-
-        if (arpList.getOctaves() > 0) {
-          n->currOctave = (n->currOctave + arpList.getDirFlag()) % arpList.getOctaves();
-        }
-        i++;
-      }
-      arpList.incrementStep();
-    } else {
-      // turn off previous note
-      ArpNote_t *last = arpList.getPrevNote();
-      if (last != nullptr) {
-        sendMidiBoth(midi::MidiType::NoteOff, last->note + (last->lastOctave * 12), last->velocity,
-                    last->channel);
-      }
+    uint8_t ratchets = arpList.getStep(stepIdx);
+    if (ratchets > 1) ratchetCount = ratchets;
+    ratchetLength = length / ratchetCount;
+
+    // Gates end by the next step at the latest, playStep ends any still playing
+    arpList.releaseDue(nextEventPos);
+    arpList.playStep(nextEventPos + getGateLength(ratchetLength));
+  }
 
-      // turn on current note
-      ArpNote_t *curr = arpList.getNote();
-      if (curr != nullptr) {
-        // Safety for making sure the octave is within range
-        checkOctaveBounds(curr);
+  if (mode == ARPMODE_DEFAULT) {
+    turnOnLed = true;
+    ledOffPos = nextEventPos + stepLength / 2;
+  }
+}
 
-        sendMidiBoth(midi::MidiType::NoteOn, curr->note + (curr->currOctave * 12), curr->velocity,
-                    curr->channel);
+void ArpEffect::serviceSteps(Pos_t pos) {
+  if (isTransportStopped) {
+    return;
+  }
 
-        curr->lastOctave = curr->currOctave;
+  // Start again from here if we've fallen well behind
+  if ((int32_t)(pos - nextEventPos) > (int32_t)(stepLength * 2)) {
+    resyncSteps(pos);
+  }
 
-        if (arpList.getOctaves() > 0) {
-          curr->currOctave = (curr->currOctave + arpList.getDirFlag()) % arpList.getOctaves();
-        }
-      }
+  while (posReached(pos, nextEventPos)) {
+    // Play the step, or the next ratchet of it, from its scheduled position
+    if (ratchetNum == 0) {
+      startStep();
+    } else {
+      arpList.retrigger(nextEventPos + getGateLength(ratchetLength));
+    }
+
+    ratchetNum++;
+    if (ratchetNum < ratchetCount) {
+      nextEventPos += ratchetLength;
+    } else {
+      ratchetNum = 0;
+      gridPos += stepLength;
+      nextEventPos = gridPos + ((arpList.getStepIdx() & 1) ? swingOffset : 0);
     }
   }
-}
 
-void ArpEffect::checkOctaveBounds(ArpNote_t *ap) {
-  if ((int8_t)ap->note + (ap->currOctave * 12) > 127) {
-    ap->currOctave--;
-  } else if ((int8_t)ap->note + (ap->currOctave * 12) < 0) {
-    ap->currOctave++;
+  arpList.releaseDue(pos);
+
+  if (clockLedOn && posReached(pos, ledOffPos)) {
+    turnOffLed = true;
   }
 }
 
@@ -338,17 +497,11 @@ void ArpEffect::handleMidiMessage(
     break;
   case midi::MidiType::ActiveSensing: // Has seperate handler
     break;
-  case midi::MidiType::Continue: // Send continue
-    hardwareMIDI.sendContinue();
-    usbMIDI.sendContinue();
+  case midi::MidiType::Continue: // Has seperate handler
     break;
-  case midi::MidiType::Start: // Send start
-    hardwareMIDI.sendStart();
-    usbMIDI.sendStart();
+  case midi::MidiType::Start: // Has seperate handler
     break;
-  case midi::MidiType::Stop: // Send stop
-    hardwareMIDI.sendStop();
-    usbMIDI.sendStop();
+  case midi::MidiType::Stop: // Has seperate handler
     break;
   case midi::MidiType::NoteOn: {
     if (isActive) {
@@ -382,20 +535,21 @@ void ArpEffect::handleMidiMessage(
   }
 }
 
-void ArpEffect::process(State_t *state) {
-  unsigned long now = millis();
-
-  if (!isInitialised) {
-    isStompActive = state->isActive;
-    arpList.setPlayMode(state->rotaryPos);
-    isInitialised = true;
-  }
-
+void ArpEffect::updateLed(State_t *state) {
   /* Set the correct LED colour based on states */
   if (state->isActive) {
-    if (inProgramMode) {
-      if (arpList.getStep(state->rotaryPos)) setLed(0, 0, 255); // Blue
-      else setLed(127, 127, 127); // White
+    if (mode == ARPMODE_PROGRAM) {
+      switch (arpList.getStep(state->rotaryPos)) {
+      case 0: setLed(127, 127, 127); break; // White
+      case 1: setLed(0, 0, 255); break; // Blue
+      case 2: setLed(0, 255, 255); break; // Cyan
+      case 3: setLed(255, 0, 255); break; // Purple
+      default: setLed(255, 0, 0); break; // Red
+      }
+    } else if (mode == ARPMODE_GATE) {
+      setLed(0, 255, 0); // Green
+    } else if (mode == ARPMODE_SWING) {
+      setLed(255, 0, 127); // Pink
     } else if (turnOffLed) {
       setLed(0, 0, 0); // Off
       turnOffLed = false;
@@ -410,56 +564,69 @@ void ArpEffect::process(State_t *state) {
   } else {
     setLed(0, 0, 0); // Off
   }
+}
+
+void ArpEffect::handleControls(State_t *state) {
+  if (!isInitialised) {
+    isStompActive = state->isActive;
+    arpList.setPlayMode(state->rotaryPos);
+    isInitialised = true;
+  }
 
   /* Change play mode if rotary changed and in normal mode */
   if (
     state->rotaryMoved && 
-    !inProgramMode && 
+    mode == ARPMODE_DEFAULT && 
     state->rotaryPos < NUM_PLAYMODE
   ) {
     arpList.setPlayMode(state->rotaryPos);
   }
 
-  /* Save the tap time for ext footswitch click for internal clock source */
-  switch (state->extEvent) {
-  case Click: // Shuffle the last tap over, and add the current tap interval
-    extTapIntervalsMs[1] = extTapIntervalsMs[0];
-    extTapIntervalsMs[0] = now - lastExtTapMs;
-    lastExtTapMs = now;
-    extClockIntervalMs = ((extTapIntervalsMs[0] + extTapIntervalsMs[1]) / 2)/4;
-    break;
-  default: 
-    break;
+  /* Change the gate length if rotary changed and in gate mode */
+  if (
+    state->rotaryMoved &&
+    mode == ARPMODE_GATE &&
+    state->rotaryPos < NUM_ARP_GATES
+  ) {
+    gate = state->rotaryPos;
+    settings.setArpGate(gate);
   }
 
-  /* Limit footswitch time by setting to now on timeout */
-  if (now - lastExtTapMs > EXT_TIMEOUT) {
-    lastExtTapMs = now;
+  /* Change the swing if rotary changed and in swing mode */
+  if (
+    state->rotaryMoved &&
+    mode == ARPMODE_SWING &&
+    state->rotaryPos < NUM_ARP_SWINGS
+  ) {
+    setSwing(state->rotaryPos);
+    settings.setArpSwing(swing);
   }
 
-  /* Handle clock generation when no midi clock is available */
-  unsigned long clockTimeout = now - lastClockMs > CLOCK_TIMEOUT;
-  unsigned long extTime = now - lastExtClockMs;
-  if ( // Play next step if ext reach and no midi clock
-    clockTimeout &&
-    (extTime > extClockIntervalMs)
-  ) {
-    advanceArpStep();
-    lastExtClockMs = now;
-    turnOnLed = true;
-  } else if ( // Turn off clock led if half ext clock time reached
-    clockTimeout && // and there's no midi clock
-    (extTime > extClockIntervalMs/2) &&
-    clockLedOn
-  ) {
-    turnOffLed = true;
+  /* Ext footswitch taps set the tempo for the internal clock source */
+  if (tapTempo.update()) {
+    timebase.setInternalQuarter(tapTempo.getQuarterTicks());
+  }
+
+  switch (state->extEvent) {
+  case LongPress: // Toggle retriggering every chord note on every step
+    // The press wasn't a tap, so undo any tempo it set
+    if (tapTempo.cancelTap()) {
+      timebase.setInternalQuarter(tapTempo.getQuarterTicks());
+    }
+    arpList.setRetriggerAll(!arpList.getRetriggerAll());
+    settings.setArpRetrigger(arpList.getRetriggerAll());
+    break;
+  default: 
+    break;
   }
 
   /* Handle the stomp footswitch state */
   switch (state->stompEvent) {
   case Click:
-    if (inProgramMode) {
-      arpList.toggleStep(state->rotaryPos);
+    if (mode == ARPMODE_PROGRAM) {
+      arpList.cycleStep(state->rotaryPos);
+    } else if (mode == ARPMODE_GATE || mode == ARPMODE_SWING) {
+      mode = ARPMODE_DEFAULT;
     } else {
       if (state->isActive) {
         arpList.clear(); // Clear the list and send notes off
@@ -470,15 +637,21 @@ void ArpEffect::process(State_t *state) {
     break;
   case LongPress:
     if (state->isActive) {
-      inProgramMode = !inProgramMode;
+      mode = (ArpMode_t)((mode + 1) % NUM_ARPMODE); // Next mode
     }
     break;
   default:
     break;
   }
+}
+
+void ArpEffect::process(State_t *state) {
+  /* Play the steps, ratchets and note offs that are due */
+  // The timebase counts its own pulses when there's no midi clock
+  serviceSteps(timebase.getPosition(nowTicks()));
 
   /* Handle incoming midi */
-  if (usbMIDI.read()) {
+  if (usbMIDI.read() && !isRoutedMessage(usbMIDI.getType())) {
     if (usbMIDI.getChannel() == state->midiChannel) {
       handleMidiMessage(state->isActive, usbMIDI.getType(), usbMIDI.getData1(),
                       usbMIDI.getData2(), usbMIDI.getChannel());
@@ -488,7 +661,7 @@ void ArpEffect::process(State_t *state) {
     
   }
 
-  if (hardwareMIDI.read()) {
+  if (hardwareMIDI.read() && !isRoutedMessage(hardwareMIDI.getType())) {
     if (hardwareMIDI.getChannel() == state->midiChannel) {
     handleMidiMessage(state->isActive, hardwareMIDI.getType(), hardwareMIDI.getData1(),
                       hardwareMIDI.getData2(), hardwareMIDI.getChannel());
@@ -500,26 +673,72 @@ void ArpEffect::process(State_t *state) {
 
 void ArpEffect::handlePanic() {
   arpList.clear();
-  for (uint8_t i = 0; i < 16; i++) { // 16 midi channels total
-    sendMidiBoth(midi::MidiType::ControlChange, midi::AllNotesOff, 0, i+1);
-  }
+  noteTracker.releaseAll();
 }
 
 void ArpEffect::handleClock() {
-  hardwareMIDI.sendClock();
-  usbMIDI.sendClock();
-
-  clockCount++;
-  if (clockCount >= clocksPerStep) {
-    clockCount = 0;
-    advanceArpStep(); // queue next note
-    if (!inProgramMode) {
-      turnOnLed = true;
+  // Steps that land on this pulse play straight away
+  serviceSteps(timebase.getPosition(nowTicks()));
+}
+
+void ArpEffect::handleTransport(TransportEvent_t event) {
+  switch (event) {
+  case TRANSPORT_EVENT_PLAY: {
+    // Line the steps up with the song, so the first one lands on this pulse
+    // after Start, and a Continue or Song Position picks up mid pattern
+    uint32_t songPulse = transport.getSongPulse();
+    uint32_t step = (songPulse + clocksPerStep - 1) / clocksPerStep;
+    gridPos = timebase.getPulsePosition() + (step * clocksPerStep - songPulse) * POS_PER_PULSE;
+    nextEventPos = gridPos + ((step & 1) ? swingOffset : 0);
+    ratchetLength = stepLength;
+    ratchetNum = 0;
+    ratchetCount = 1;
+    arpList.locate(step);
+    isTransportStopped = false;
+    break;
+  }
+  case TRANSPORT_EVENT_STOP:
+    isTransportStopped = true;
+    arpList.releasePlaying();
+    turnOffLed = clockLedOn;
+    break;
+  case TRANSPORT_EVENT_FREE:
+    if (isTransportStopped) {
+      isTransportStopped = false;
+      resyncSteps(timebase.getPosition(nowTicks()));
     }
-  } else if (clockCount == clocksPerStep/2) {
-    turnOffLed = true;
+    break;
+  }
+}
+
+void ArpEffect::savePreset(Preset_t &preset) {
+  preset.param = arpList.getPlayMode();
+  preset.gate = gate;
+  preset.swing = swing;
+  preset.retrigger = arpList.getRetriggerAll();
+  for (uint8_t i = 0; i < SETTINGS_ARP_STEPS; i++) {
+    setPresetStep(preset, i, arpList.getStep(i));
   }
-  lastClockMs = millis();
 }
 
+void ArpEffect::loadPreset(const Preset_t &preset, State_t *state) {
+  // Taking the play mode from the rotary would undo the preset's
+  isInitialised = true;
+  isStompActive = state->isActive;
+  mode = ARPMODE_DEFAULT;
 
+  arpList.setPlayMode(preset.param);
+  if (preset.gate < NUM_ARP_GATES) {
+    gate = preset.gate;
+    settings.setArpGate(gate);
+  }
+  if (preset.swing < NUM_ARP_SWINGS) {
+    setSwing(preset.swing);
+    settings.setArpSwing(swing);
+  }
+  arpList.setRetriggerAll(preset.retrigger == 1);
+  settings.setArpRetrigger(arpList.getRetriggerAll());
+  for (uint8_t i = 0; i < SETTINGS_ARP_STEPS; i++) {
+    arpList.setStep(i, getPresetStep(preset, i));
+  }
+}
@@ -4,10 +4,14 @@
 #include "Globals.h"
 #include "BaseEffect.h"
 #include "Switches.h"
+#include "Timebase.h"
+#include "NoteBitmap.h"
+#include "TimerHeap.h"
+#include "Random.h"
 
-typedef enum { ARPMODE_DEFAULT, ARPMODE_PROGRAM, NUM_ARPMODE } ArpMode_t; // The current mode the arp effect is in
+typedef enum { ARPMODE_DEFAULT, ARPMODE_PROGRAM, ARPMODE_GATE, ARPMODE_SWING, NUM_ARPMODE } ArpMode_t; // The current mode the arp effect is in
 
-typedef enum { AP, UP, DOWN, UPDOWN, RAND } ArpDirection_t; // The direction for the ArpPlayMode_t struct
+typedef enum { AP, UP, DOWN, UPDOWN, RAND, SHUFFLE } ArpDirection_t; // The direction for the ArpPlayMode_t struct
 
 typedef struct {
   uint8_t octaveSpan;
@@ -41,60 +45,121 @@ const ArpPlayMode_t playModes[NUM_PLAYMODE] = {
   // Random modes + octs
   {1, false, RAND},
   {2, false, RAND},
-  {3, false, RAND},
+
+  // Shuffle, every note once per cycle in a random order
+  {1, false, SHUFFLE},
+};
+
+/* GATE LENGTHS */
+// How long a note plays for, out of 256ths of a step
+#define NUM_ARP_GATES 4
+#define DEFAULT_ARP_GATE 3
+const uint16_t ARP_GATES[NUM_ARP_GATES] = {
+  64,  // 25%
+  128, // 50%
+  192, // 75%
+  256, // 100%
 };
 
-#define NOTE_BUFFER_SIZE 20
+/* SWING */
+// The off beat steps are delayed by up to half a step (75% swing)
+#define NUM_ARP_SWINGS 16
+#define ARP_SWING_DIVISOR 30 // Swing 15 = 15/30 of a step
+
+/* RATCHETS */
+// Each step plays 0 (muted), 1 or up to 4 times
+#define ARP_MAX_RATCHETS 4
+
+#define NOTE_BUFFER_SIZE 32 // Max held notes, one bit per slot in a uint32_t
+#define ARP_NO_SLOT 0xFF
+#define ARP_NOT_PLAYING 0xFF
+
+/* ARP SEQUENCE */
+// Each step of the sequence is one byte, the slot of the note in the low 5
+// bits and a signed octave offset (-4 to 3) in the top 3 bits
+#define ARP_MAX_OCTAVES 3
+#define ARP_SEQUENCE_SIZE (NOTE_BUFFER_SIZE * ARP_MAX_OCTAVES * 2) // Room for UPDOWN
+#define ARP_SLOT_MASK 0x1F
+#define ARP_OCTAVE_SHIFT 5
 
 typedef struct {
   uint8_t note;
   uint8_t velocity;
   uint8_t channel;
-  uint8_t octaves;
-  int8_t lastOctave;
-  int8_t currOctave;
+  uint8_t playing; // The pitch the arp is playing for this note, ARP_NOT_PLAYING if none
   bool isReleased;
 } ArpNote_t;
 
 /* BEGIN ARPLIST CLASS */
+// Held notes live in a pool of slots that never move. The held pitches are a
+// bitmap, so the notes are sorted by a bit scan rather than on insert, and a
+// pitch -> slot table makes lookups O(1). The order the notes were played in is
+// kept separately for AP mode.
+// Whenever the notes or the play mode change, the whole cycle (notes, octaves
+// and direction) is compiled into a flat sequence, so a step only has to read
+// the next entry.
 class ArpList {
 private:
-  ArpNote_t noteList[NOTE_BUFFER_SIZE] = {}; // The list of notes being held down
-  bool stepList[16];  // The 16 steps available for muting
-  uint8_t size;    // The size of the noteList
+  ArpNote_t notes[NOTE_BUFFER_SIZE]; // The held notes, indexed by slot
+  uint32_t usedSlots;  // Bit per slot that holds a note
+  uint32_t playingSlots; // Bit per slot that has a note playing
+  TimerHeap<NOTE_BUFFER_SIZE> gates; // When each playing note is due to be turned off
+  NoteBitmap heldPitches; // Bit per held pitch
+  uint8_t slotOf[128]; // The slot holding each pitch, ARP_NO_SLOT if not held
+  uint8_t playOrder[NOTE_BUFFER_SIZE]; // Slots in the order they were played
+  uint8_t stepList[16];  // The times each of the 16 steps plays, 0 = muted
+  uint8_t size;    // The number of held notes
+
+  uint8_t sequence[ARP_SEQUENCE_SIZE]; // The compiled cycle of notes to play
+  uint8_t seqLength; // The number of entries in the sequence
+  uint8_t seqIdx;  // The index of the next entry to play
+  uint8_t stepWidth; // Entries played per step, all the held notes in chord mode
+  uint8_t lastStart; // The first entry the last step played, for ratchets
+  uint8_t lastWidth; // The number of entries the last step played
 
-  uint8_t noteIdx; // The index of the next note to play
   uint8_t stepIdx; // The index of the next step
-  int8_t prevNoteIdx; // The index of the previous note played
-  int8_t prevStepIdx; // The index of the previous step
-
-  int8_t directionFlag; // The current arp direction. up = 1, down = -1.
 
   ArpPlayMode_t playMode; // The current play mode for arpeggiator
+  uint8_t playModeIdx; // Index into playModes
 
   bool isHoldMode; // Is the arp in hold mode
+  bool retriggerAll; // Chord mode retriggers every note, not just the ones that change
+  Random rng; // For the random and shuffle modes
+
+  void shuffle(); // Reorder the sequence for the next shuffle cycle
+
+  void append(uint8_t slot, int8_t octave); // Add an entry to the sequence
+  void compile(); // Rebuild the sequence from the held notes and play mode
+  uint8_t entryPitch(uint8_t entry);
+  void playEntry(uint8_t entry, Pos_t offPos);
+  void voiceStep(Pos_t offPos); // Move from the playing notes to the last step's notes
+  void releaseSlot(uint8_t slot);
 
 public:
   ArpList();
-  void add(midi::DataByte note, midi::DataByte velocity,
-            midi::DataByte channel); // Add a note to the list depending on the arpFormat
+  void seedRandom(uint32_t seed); // Restart the random sequence, the same seed plays the same notes
+  bool add(midi::DataByte note, midi::DataByte velocity,
+            midi::DataByte channel); // Add a note to the list, false if the list is full
   void del(midi::DataByte note);     // Delete a specific note from the list
 
   uint8_t getSize(); // Get list size
-  uint8_t getOctaves(); // Get the number of octaves to span
-  int8_t getDirFlag(); // Get the current direction flag
-  ArpNote_t *getNote(); // Retrieve the note to play
-  ArpNote_t *getPrevNote(); // Retrieve the previous note played
   bool inHoldMode(); // Is the arp in hold mode
-
-  void toggleStep(uint8_t index);
-  bool isChordMode();
-  void incrementStep();
-  bool getStep(uint8_t index);
-  ArpNote_t *getNoteAt(uint8_t pos); // Get a note at a specific position, or if no note, return null
+  void setRetriggerAll(bool state);
+  bool getRetriggerAll();
+
+  bool playStep(Pos_t offPos); // Play the next step until offPos, false if the step is muted or nothing is held
+  void retrigger(Pos_t offPos); // Play the last step's notes again, for ratchets
+  void releaseDue(Pos_t pos); // Note off for the notes whose gate has ended
+  void releasePlaying(); // Note off for the notes the arp is playing
+  void cycleStep(uint8_t index); // Step through normal, 2-4 ratchets and muted
+  uint8_t getStep(uint8_t index); // How many times the step plays, 0 if muted
+  void setStep(uint8_t index, uint8_t ratchets);
+  uint8_t getStepIdx(); // The index of the next step
+  void locate(uint32_t step); // Move to where the arp would be after playing 'step' steps
   ArpNote_t *getNoteFromPitch(midi::DataByte note); // Get the note from specific pitch, or if no note, return null
   bool allNotesReleased(); // have all the notes been released
   void setPlayMode(uint8_t pos);
+  uint8_t getPlayMode();
   void clear(); // Clear the list and send note off for all the remaining notes
 };
 /* END ARPLIST CLASS */
@@ -102,40 +167,52 @@ public:
 class ArpEffect : public BaseEffect {
 private:
   ArpList arpList; // The list of arpeggiator notes
-  bool inProgramMode; // Is the effect in step program mode?
+  ArpMode_t mode; // What the stomp switch and rotary are currently editing
+  uint8_t gate; // Index into ARP_GATES
+  uint8_t swing; // How far the off beat steps are delayed (0-15)
 
-  /* Clock */
-  volatile unsigned long lastClockMs; // The last clock pulse time
-  volatile uint8_t clockCount; // The current clock step we're on
+  /* Steps */
+  // Steps and ratchets are scheduled in timebase positions, which interpolate
+  // between clock pulses, so they can land between pulses
   uint8_t clocksPerStep; // How many clock steps we need before we trigger an arp play
-
-  /* External footswitch tempo input */
-  unsigned long extTapIntervalsMs[2]; // the last two (2) recorded ext footswitch tap intervals
-  unsigned long lastExtTapMs; // Use this to calculate the intervals above
-  unsigned long extClockIntervalMs; // Use this when no external clock is available
-  unsigned long lastExtClockMs; // Use to calculate when to trigger next step on ext clock
+  Pos_t stepLength; // The length of a step
+  Pos_t swingOffset; // How far the off beat steps are delayed
+  Pos_t gridPos; // Where the current step sits without swing
+  Pos_t nextEventPos; // When the next step or ratchet plays
+  Pos_t ratchetLength; // The gap between the current step's ratchets
+  uint8_t ratchetNum; // The ratchets played so far in the current step
+  uint8_t ratchetCount; // The ratchets the current step plays
+  bool isTransportStopped; // Frozen by a midi Stop
 
   /* Clock LED */
-  volatile bool turnOnLed; // Do we need to turn on the led?
-  volatile bool turnOffLed; // Do we need to turn off the led? 
-  bool clockLedOn; // 
-  unsigned long lastLedOnTime;
+  bool turnOnLed; // Do we need to turn on the led?
+  bool turnOffLed; // Do we need to turn off the led? 
+  bool clockLedOn; // Is the clock led currently on?
+  Pos_t ledOffPos; // When to turn the clock led off
 
   /* State copies */
   bool isStompActive; // Use this as a 'global' reference to isActive for the advanceArpStep function
 
   bool isInitialised;
  
-  void advanceArpStep();
+  void startStep();
+  void serviceSteps(Pos_t pos);
+  void resyncSteps(Pos_t pos);
+  Pos_t getGateLength(Pos_t length);
+  void setSwing(uint8_t amount);
   void handleMidiMessage(bool isActive, midi::MidiType type, midi::DataByte data1,
                           midi::DataByte data2, midi::Channel channel);
-  void checkOctaveBounds(ArpNote_t *ap);
 
 public:
   ArpEffect();
   void process(State_t *state) override;
+  void handleControls(State_t *state) override;
+  void updateLed(State_t *state) override;
   void handlePanic() override;
   void handleClock() override;
+  void savePreset(Preset_t &preset) override;
+  void loadPreset(const Preset_t &preset, State_t *state) override;
+  void handleTransport(TransportEvent_t event) override;
 };
 
 #endif // ARP_H
\ No newline at end of file
@@ -2,12 +2,20 @@
 #define BASE_EFFECT_H
 
 #include "Globals.h"
+#include "Transport.h"
+#include "Presets.h"
 
 class BaseEffect {
 public:
-    virtual void process(State_t *state) = 0;
+    virtual void process(State_t *state) = 0; // Midi in and anything timing critical, every loop
+    virtual void handleControls(State_t *state) = 0; // Switch and rotary events
+    virtual void updateLed(State_t *state) = 0;
     virtual void handlePanic() = 0;
     virtual void handleClock() = 0;
+    virtual void handleTransport(TransportEvent_t event) {} // Only clocked effects need this
+    virtual void savePreset(Preset_t &preset) = 0; // Fill in the parts of the preset the effect uses
+    virtual void loadPreset(const Preset_t &preset, State_t *state) = 0; // The state's isActive is already set
+    virtual bool isClockThru() { return true; } // Forward the incoming clock as it is?
     virtual ~BaseEffect() {}
 };
 
@@ -1,5 +1,6 @@
 #include "ChordGenEffect.h"
 #include "Utils.h"
+#include "NoteTracker.h"
 
 void ChordGenEffect::handleMidiMessage(
   bool isActive, 
@@ -13,14 +14,11 @@ void ChordGenEffect::handleMidiMessage(
     break;
   case midi::MidiType::ActiveSensing: // Has seperate handler
     break;
-  case midi::MidiType::Start: // Send start
-    sendMidiStart();
+  case midi::MidiType::Start: // Has seperate handler
     break;
-  case midi::MidiType::Stop: // Send stop
-    sendMidiStop();
+  case midi::MidiType::Stop: // Has seperate handler
     break;
-  case midi::MidiType::Continue: // Send continue
-    sendMidiContinue();
+  case midi::MidiType::Continue: // Has seperate handler
     break;
   case midi::MidiType::NoteOn: {
     // Either send chord or pass through original MIDI
@@ -87,11 +85,9 @@ void ChordGenEffect::saveOldNotes(
 
 void ChordGenEffect::removeOldNotes() {
   if (hasOldNotes) {
+    // Only the old notes that are still sounding get a note off
     for (uint8_t i = 0; i < MAX_CHORD_TONES; i++) {
-      hardwareMIDI.sendNoteOff(lastNote + oldNotes[i], lastVelocity,
-                               lastChannel);
-      usbMIDI.sendNoteOff(lastNote + oldNotes[i], lastVelocity,
-                          lastChannel);
+      noteTracker.releaseNote(lastChannel, lastNote + oldNotes[i]);
     }
     hasOldNotes = false;
   }
@@ -135,23 +131,30 @@ ChordGenEffect::ChordGenEffect(uint8_t bankNum) {
 }
 
 void ChordGenEffect::handlePanic() {
-  for (uint8_t i = 0; i < 16; i++) { // 16 midi channels total
-    sendMidiBoth(midi::MidiType::ControlChange, midi::AllNotesOff, 0, i+1);
-  }
+  noteTracker.releaseAll();
 }
 
 void ChordGenEffect::handleClock() {
-  hardwareMIDI.sendClock();
-  usbMIDI.sendClock();
+  // Clock is forwarded before this is called, nothing else to do
 }
 
-void ChordGenEffect::process(State_t *state) {
+void ChordGenEffect::savePreset(Preset_t &preset) {
+  preset.param = chordIdx;
+}
+
+void ChordGenEffect::loadPreset(const Preset_t &preset, State_t *state) {
+  if (preset.param < NUM_CHORDS) chordIdx = preset.param;
+}
+
+void ChordGenEffect::updateLed(State_t *state) {
   if (state->isActive) {
     setLed(0, 255, 0); // Green
   } else {
     setLed(0, 0, 0); // Off
   }
+}
 
+void ChordGenEffect::handleControls(State_t *state) {
   if (state->rotaryMoved) {
     const Chord_t oldChord = chordBank[chordIdx];
     chordIdx = state->rotaryPos;
@@ -161,8 +164,10 @@ void ChordGenEffect::process(State_t *state) {
 
   handleSwitchEvent(state, state->stompEvent);
   handleSwitchEvent(state, state->extEvent);
+}
 
-  if (usbMIDI.read()) {
+void ChordGenEffect::process(State_t *state) {
+  if (usbMIDI.read() && !isRoutedMessage(usbMIDI.getType())) {
     if (usbMIDI.getChannel() == state->midiChannel) {
       handleMidiMessage(state->isActive, usbMIDI.getType(), usbMIDI.getData1(),
                       usbMIDI.getData2(), usbMIDI.getChannel());
@@ -172,7 +177,7 @@ void ChordGenEffect::process(State_t *state) {
     
   }
 
-  if (hardwareMIDI.read()) {
+  if (hardwareMIDI.read() && !isRoutedMessage(hardwareMIDI.getType())) {
     if (hardwareMIDI.getChannel() == state->midiChannel) {
       handleMidiMessage(state->isActive, hardwareMIDI.getType(), hardwareMIDI.getData1(),
                       hardwareMIDI.getData2(), hardwareMIDI.getChannel());
@@ -123,8 +123,12 @@ private:
 public:
   ChordGenEffect(uint8_t bankNum);
   void process(State_t *state) override;
+  void handleControls(State_t *state) override;
+  void updateLed(State_t *state) override;
   void handlePanic() override;
   void handleClock() override;
+  void savePreset(Preset_t &preset) override;
+  void loadPreset(const Preset_t &preset, State_t *state) override;
 };
 
 #endif // CHORDGEN_H
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "ClockArbiter.h"
+#include "TempoTracker.h"
+
+ClockArbiter::ClockArbiter() {
+  active = CLOCK_SOURCE_INTERNAL;
+  takeoverPulses = 0;
+  for (uint8_t i = 0; i < NUM_EXT_CLOCK_SOURCES; i++) {
+    lastPulseTick[i] = 0;
+    isAlive[i] = false;
+  }
+}
+
+void ClockArbiter::setActive(ClockSource_t source) {
+  if (source == active) {
+    return;
+  }
+
+  // The new source's pulses won't line up with the old ones, so find the
+  // phase again (the tempo is kept until then)
+  if (active != CLOCK_SOURCE_INTERNAL && source != CLOCK_SOURCE_INTERNAL) {
+    tempoTracker.reset();
+  }
+  active = source;
+  takeoverPulses = 0;
+}
+
+bool ClockArbiter::acceptClock(ClockSource_t source, Tick_t now) {
+  if (source >= NUM_EXT_CLOCK_SOURCES) {
+    return false;
+  }
+  Tick_t gap = now - lastPulseTick[source];
+  bool wasAlive = isAlive[source];
+  lastPulseTick[source] = now;
+  isAlive[source] = true;
+
+  if (source == active) {
+    return true;
+  }
+
+  // Nothing external is running, so take over straight away
+  if (active == CLOCK_SOURCE_INTERNAL) {
+    setActive(source);
+    return true;
+  }
+
+  // A higher priority source takes over once it's sent a few pulses
+  if (source < active) {
+    // Stray pulses spread out over a while don't add up
+    if (!wasAlive || gap > CLOCK_TAKEOVER_GAP_MS * TICKS_PER_MS) {
+      takeoverPulses = 0;
+    }
+    if (++takeoverPulses >= CLOCK_TAKEOVER_PULSES) {
+      setActive(source);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ClockArbiter::acceptTransport(ClockSource_t source) {
+  // Without external clock, any source can start and stop things
+  return source == active || active == CLOCK_SOURCE_INTERNAL;
+}
+
+void ClockArbiter::refresh(Tick_t now) {
+  for (uint8_t i = 0; i < NUM_EXT_CLOCK_SOURCES; i++) {
+    if (isAlive[i] && now - lastPulseTick[i] > CLOCK_TIMEOUT * TICKS_PER_MS) {
+      isAlive[i] = false;
+    }
+  }
+
+  // Fail over to the highest priority source that's still running
+  if (active != CLOCK_SOURCE_INTERNAL && !isAlive[active]) {
+    ClockSource_t next = CLOCK_SOURCE_INTERNAL;
+    for (uint8_t i = 0; i < NUM_EXT_CLOCK_SOURCES; i++) {
+      if (isAlive[i]) {
+        next = (ClockSource_t)i;
+        break;
+      }
+    }
+    setActive(next);
+  }
+}
+
+ClockSource_t ClockArbiter::getActive() { return active; }
@@ -0,0 +1,50 @@
+#ifndef CLOCK_ARBITER_H
+#define CLOCK_ARBITER_H
+
+#include "Globals.h"
+#include "Timebase.h"
+
+#define CLOCK_TAKEOVER_PULSES 3 // Pulses a higher priority source needs to send before it takes over
+#define CLOCK_TAKEOVER_GAP_MS 100 // A longer gap between them starts the count again (slower than 25 BPM)
+
+/* CLOCK SOURCES */
+// In priority order
+typedef enum {
+  CLOCK_SOURCE_DIN,
+  CLOCK_SOURCE_USB,
+  CLOCK_SOURCE_INTERNAL,
+  NUM_CLOCK_SOURCES
+} ClockSource_t;
+
+#define NUM_EXT_CLOCK_SOURCES CLOCK_SOURCE_INTERNAL
+
+/* CLOCK ARBITER CLASS */
+// Clock and transport messages can come in over DIN and USB. Only one source
+// is followed at a time, so two sources running together can't double the
+// tempo. DIN beats USB, and either beats the internal master clock.
+// A source that stops sending for CLOCK_TIMEOUT fails over to the next one that's
+// still running. A higher priority source has to send a few pulses in a row
+// before it takes over, so a stray pulse doesn't make the clock jump about.
+// The active source's pulses land in between a running source's, so "in a
+// row" means no gap longer than a pulse at the slowest tempo.
+class ClockArbiter {
+private:
+  ClockSource_t active; // The source being followed
+  Tick_t lastPulseTick[NUM_EXT_CLOCK_SOURCES]; // When each source last sent a pulse
+  bool isAlive[NUM_EXT_CLOCK_SOURCES]; // Has each source sent a pulse within the timeout?
+  uint8_t takeoverPulses; // Pulses in a row from a higher priority source
+
+  void setActive(ClockSource_t source);
+
+public:
+  ClockArbiter();
+  bool acceptClock(ClockSource_t source, Tick_t now); // Should this pulse be used?
+  bool acceptTransport(ClockSource_t source); // Should this Start/Stop/Continue/Song Position be used?
+  void refresh(Tick_t now); // Call every loop to fail over from sources that have stopped
+  ClockSource_t getActive();
+};
+/* END CLOCK ARBITER CLASS */
+
+extern ClockArbiter clockArbiter;
+
+#endif // CLOCK_ARBITER_H
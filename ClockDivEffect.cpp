@@ -0,0 +1,114 @@
+#include "Arduino.h"
+#include "Settings.h"
+#include "Utils.h"
+#include "NoteTracker.h"
+#include "ClockMultiplier.h"
+#include "ClockDivEffect.h"
+
+ClockDivEffect::ClockDivEffect() {
+  divideCount = 0;
+  isStompActive = false;
+
+  uint8_t savedRatio = settings.getClockDivRatio();
+  setRatio(savedRatio < NUM_CLOCK_RATIOS ? savedRatio : DEFAULT_CLOCK_RATIO);
+
+  clockMultiplier.begin();
+}
+
+ClockDivEffect::~ClockDivEffect() {
+  clockMultiplier.end();
+}
+
+void ClockDivEffect::setRatio(uint8_t idx) {
+  ratioIdx = idx;
+  divideCount = 0;
+}
+
+void ClockDivEffect::showRatio() {
+  const ClockRatio_t &ratio = CLOCK_RATIOS[ratioIdx];
+  if (!isStompActive) {
+    setLed(0, 0, 0); // Off
+  } else if (ratio.divide > 1) {
+    setLed(0, 0, 255); // Blue
+  } else if (ratio.multiply > 1) {
+    setLed(255, 0, 0); // Red
+  } else {
+    setLed(0, 255, 0); // Green
+  }
+}
+
+void ClockDivEffect::updateLed(State_t *state) {
+  showRatio();
+}
+
+void ClockDivEffect::handleControls(State_t *state) {
+  if (state->stompEvent == Click) {
+    state->isActive = !state->isActive;
+    divideCount = 0;
+  }
+  isStompActive = state->isActive;
+
+  if (state->rotaryMoved && state->rotaryPos < NUM_CLOCK_RATIOS) {
+    setRatio(state->rotaryPos);
+    settings.setClockDivRatio(ratioIdx);
+  }
+}
+
+void ClockDivEffect::process(State_t *state) {
+  clockMultiplier.sendPending();
+
+  // Everything other than clock passes straight through
+  if (usbMIDI.read() && !isRoutedMessage(usbMIDI.getType())) {
+    sendMidiBoth(usbMIDI.getType(), usbMIDI.getData1(), usbMIDI.getData2(), usbMIDI.getChannel());
+  }
+
+  if (hardwareMIDI.read() && !isRoutedMessage(hardwareMIDI.getType())) {
+    sendMidiBoth(hardwareMIDI.getType(), hardwareMIDI.getData1(), hardwareMIDI.getData2(), hardwareMIDI.getChannel());
+  }
+}
+
+void ClockDivEffect::handlePanic() {
+  noteTracker.releaseAll();
+}
+
+void ClockDivEffect::handleClock() {
+  if (!isStompActive) {
+    return;
+  }
+
+  const ClockRatio_t &ratio = CLOCK_RATIOS[ratioIdx];
+  if (ratio.multiply > 1) {
+    // Send the pulse now, and fill in the rest before the next one is due
+    clockMultiplier.flush();
+    sendMidiClock();
+    clockMultiplier.burst(nowTicks(), timebase.getPulseTicks(), ratio.multiply - 1);
+  } else {
+    if (divideCount == 0) {
+      sendMidiClock();
+    }
+    divideCount = (divideCount + 1) % ratio.divide;
+  }
+}
+
+void ClockDivEffect::handleTransport(TransportEvent_t event) {
+  // The first pulse after Start is the downbeat, so it's always sent
+  if (event == TRANSPORT_EVENT_PLAY) {
+    divideCount = 0;
+  }
+}
+
+bool ClockDivEffect::isClockThru() {
+  return !isStompActive;
+}
+
+void ClockDivEffect::savePreset(Preset_t &preset) {
+  preset.param = ratioIdx;
+}
+
+void ClockDivEffect::loadPreset(const Preset_t &preset, State_t *state) {
+  isStompActive = state->isActive;
+  if (preset.param < NUM_CLOCK_RATIOS) {
+    setRatio(preset.param);
+    settings.setClockDivRatio(ratioIdx);
+  }
+}
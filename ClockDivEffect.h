@@ -0,0 +1,53 @@
+#ifndef CLOCKDIV_H
+#define CLOCKDIV_H
+
+#include "Globals.h"
+#include "BaseEffect.h"
+#include "Timebase.h"
+
+/* CLOCK RATIOS */
+typedef struct {
+  uint8_t divide;   // Send every nth incoming pulse
+  uint8_t multiply; // Send this many pulses per incoming pulse
+} ClockRatio_t;
+
+#define NUM_CLOCK_RATIOS 7
+#define DEFAULT_CLOCK_RATIO 3
+const ClockRatio_t CLOCK_RATIOS[NUM_CLOCK_RATIOS] = {
+  {4, 1}, // /4
+  {3, 1}, // /3
+  {2, 1}, // /2
+  {1, 1}, // Straight through
+  {1, 2}, // x2
+  {1, 3}, // x3
+  {1, 4}, // x4
+};
+
+/* CLOCK DIVIDER EFFECT */
+// Re-sends the incoming midi clock divided or multiplied. Dividing just skips
+// pulses, multiplying fills in pulses between the incoming ones from the
+// tracked pulse length with the timer driven ClockMultiplier.
+// Everything else passes straight through. When bypassed, the clock does too.
+class ClockDivEffect : public BaseEffect {
+private:
+  uint8_t ratioIdx; // Index into CLOCK_RATIOS
+  uint8_t divideCount; // Incoming pulses since the last one sent when dividing
+  bool isStompActive; // Copy of the pedal state for the clock handler
+
+  void setRatio(uint8_t idx);
+  void showRatio();
+public:
+  ClockDivEffect();
+  ~ClockDivEffect();
+  void process(State_t *state) override;
+  void handleControls(State_t *state) override;
+  void updateLed(State_t *state) override;
+  void handlePanic() override;
+  void handleClock() override;
+  void savePreset(Preset_t &preset) override;
+  void loadPreset(const Preset_t &preset, State_t *state) override;
+  void handleTransport(TransportEvent_t event) override;
+  bool isClockThru() override;
+};
+
+#endif // CLOCKDIV_H
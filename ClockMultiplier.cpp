@@ -0,0 +1,82 @@
+#include "Arduino.h"
+#include "ClockMultiplier.h"
+#include "MasterClock.h"
+#include <util/atomic.h>
+
+ClockMultiplier::ClockMultiplier() {
+  nextPulseTick = 0;
+  interval = 0;
+  remaining = 0;
+  usbQueued = 0;
+  usbSent = 0;
+}
+
+void ClockMultiplier::begin() {
+  TIFR0 = _BV(OCF0A); // Clear any old match
+  TIMSK0 |= _BV(OCIE0A);
+}
+
+void ClockMultiplier::end() {
+  TIMSK0 &= ~_BV(OCIE0A);
+  remaining = 0;
+}
+
+void ClockMultiplier::burst(Tick_t now, Tick_t pulseTicks, uint8_t count) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    interval = pulseTicks / (count + 1);
+    nextPulseTick = now + interval;
+    remaining = count;
+    scheduleCompare(now);
+  }
+}
+
+void ClockMultiplier::flush() {
+  // The next incoming pulse came early, so keep the pulse count right rather
+  // than dropping the late ones
+  uint8_t left;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    left = remaining;
+    remaining = 0;
+  }
+  sendPending();
+  while (left--) {
+    hardwareMIDI.sendClock();
+    usbMIDI.sendClock();
+  }
+}
+
+void ClockMultiplier::scheduleCompare(Tick_t now) {
+  // Only a pulse in the next timer period can be set up exactly, otherwise
+  // just check again next period
+  if ((nextPulseTick >> TIMER0_PERIOD_SHIFT) == (now >> TIMER0_PERIOD_SHIFT) + 1) {
+    OCR0A = (nextPulseTick >> TIMER0_COUNT_SHIFT) & 0xFF;
+  }
+}
+
+void ClockMultiplier::handleTimer() {
+  if (remaining == 0) {
+    return;
+  }
+
+  Tick_t now = micros();
+  while (remaining > 0 && tickReached(now + MASTER_CLOCK_EARLY, nextPulseTick)) {
+    nextPulseTick += interval;
+    remaining--;
+
+    midiSerial.sendClock();
+    if ((uint8_t)(usbQueued - usbSent) < 0xFF) usbQueued++;
+  }
+
+  scheduleCompare(now);
+}
+
+void ClockMultiplier::sendPending() {
+  while (usbSent != usbQueued) {
+    usbMIDI.sendClock();
+    usbSent++;
+  }
+}
+
+ISR(TIMER0_COMPA_vect) {
+  clockMultiplier.handleTimer();
+}
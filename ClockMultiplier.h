@@ -0,0 +1,39 @@
+#ifndef CLOCK_MULTIPLIER_H
+#define CLOCK_MULTIPLIER_H
+
+#include "Globals.h"
+#include "Timebase.h"
+
+/* CLOCK MULTIPLIER CLASS */
+// Sends extra clock pulses in between the incoming ones, for the clock
+// divider effect. Each incoming pulse starts a burst of pulses spread evenly
+// over the tracked pulse length, timed by the Timer0 compare A interrupt (the
+// master clock has compare B) so they don't wait on the main loop.
+// Like the master clock, the interrupt sends the DIN clock itself and counts
+// the USB pulses for the main loop to send, with the interrupt and the main
+// loop each keeping their own count.
+class ClockMultiplier {
+private:
+  volatile Tick_t nextPulseTick; // When the next pulse of the burst is due
+  volatile Tick_t interval; // The gap between the burst's pulses
+  volatile uint8_t remaining; // Pulses left in the burst
+  volatile uint8_t usbQueued; // USB pulses the interrupt left for the main loop, wraps
+  volatile uint8_t usbSent; // How many of those the main loop has sent
+
+  void scheduleCompare(Tick_t now);
+
+public:
+  ClockMultiplier();
+  void begin(); // Enable the Timer0 compare interrupt
+  void end(); // Disable it again
+  void burst(Tick_t now, Tick_t pulseTicks, uint8_t count); // Send 'count' pulses after now, within one pulse length
+  void flush(); // Send whatever's left of the burst straight away
+
+  void handleTimer(); // Called from the Timer0 compare A interrupt
+  void sendPending(); // Send the USB clock for the pulses since last time
+};
+/* END CLOCK MULTIPLIER CLASS */
+
+extern ClockMultiplier clockMultiplier;
+
+#endif // CLOCK_MULTIPLIER_H
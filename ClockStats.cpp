@@ -0,0 +1,119 @@
+#include "Arduino.h"
+#include "ClockStats.h"
+
+/* BEGIN CLOCK STAT CLASS */
+ClockStat::ClockStat() { reset(); }
+
+void ClockStat::reset() {
+  count = 0;
+  min = INT16_MAX;
+  max = INT16_MIN;
+  sum = 0;
+  for (uint8_t i = 0; i < CLOCK_STATS_BINS; i++) {
+    bins[i] = 0;
+  }
+}
+
+void ClockStat::add(int32_t value) {
+  // Clamped so the sum can't overflow before the count fills up
+  if (value > INT16_MAX) value = INT16_MAX;
+  if (value < -INT16_MAX) value = -INT16_MAX;
+
+  if (count == UINT16_MAX) {
+    count >>= 1;
+    sum >>= 1;
+    for (uint8_t i = 0; i < CLOCK_STATS_BINS; i++) {
+      bins[i] >>= 1;
+    }
+  }
+
+  count++;
+  sum += value;
+  if (value < min) min = value;
+  if (value > max) max = value;
+
+  // The bins double in width, so count how many times it halves
+  uint16_t size = (value < 0 ? -value : value) >> CLOCK_STATS_BIN_SHIFT;
+  uint8_t bin = 0;
+  while (size && bin < CLOCK_STATS_BINS - 1) {
+    bin++;
+    size >>= 1;
+  }
+  if (bins[bin] < UINT16_MAX) bins[bin]++;
+}
+
+static uint8_t packWord(uint8_t *out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+  return 2;
+}
+
+uint8_t ClockStat::pack(uint8_t *out) {
+  uint8_t len = 0;
+  int16_t mean = count > 0 ? sum / count : 0;
+  len += packWord(out + len, count);
+  len += packWord(out + len, count > 0 ? min : 0);
+  len += packWord(out + len, count > 0 ? max : 0);
+  len += packWord(out + len, mean);
+  for (uint8_t i = 0; i < CLOCK_STATS_BINS; i++) {
+    len += packWord(out + len, bins[i]);
+  }
+  return len;
+}
+/* END CLOCK STAT CLASS */
+
+ClockStats::ClockStats() {
+  lastInTick = 0;
+  hasLastIn = false;
+}
+
+void ClockStats::reset() {
+  internalQueue.clear();
+  for (uint8_t i = 0; i < NUM_CLOCK_STATS; i++) {
+    stats[i].reset();
+  }
+  hasLastIn = false;
+}
+
+void ClockStats::pulseIn(Tick_t now) {
+  // A gap after the clock stopped isn't jitter
+  if (hasLastIn && now - lastInTick < CLOCK_TIMEOUT * TICKS_PER_MS) {
+    int32_t gap = now - lastInTick;
+    stats[CLOCK_STAT_IN_JITTER].add(gap - (int32_t)timebase.getPulseTicks());
+  }
+  lastInTick = now;
+  hasLastIn = true;
+}
+
+void ClockStats::pulseOut(Tick_t inTick, Tick_t now) {
+  stats[CLOCK_STAT_SEND_TIME].add(now - inTick);
+}
+
+void ClockStats::internalPulse(int32_t lateness) {
+  stats[CLOCK_STAT_INTERNAL_JITTER].add(lateness);
+}
+
+void ClockStats::queueInternalPulse(int32_t lateness) {
+  if (lateness > INT16_MAX) lateness = INT16_MAX;
+  internalQueue.push(lateness); // Dropped if the main loop is that far behind
+}
+
+void ClockStats::refresh() {
+  int16_t lateness;
+  while (internalQueue.pop(lateness)) {
+    internalPulse(lateness);
+  }
+}
+
+uint8_t ClockStats::buildReply(uint8_t id, uint8_t *out) {
+  uint8_t raw[CLOCK_STATS_REPLY_SIZE];
+  raw[0] = id;
+
+  refresh();
+  stats[id].pack(raw + 1);
+
+  out[0] = SYSEX_ID;
+  out[1] = SYSEX_DEVICE;
+  out[2] = SYSEX_CLOCK_STATS;
+  return 3 + midi::encodeSysEx(raw, out + 3, CLOCK_STATS_REPLY_SIZE);
+}
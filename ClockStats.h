@@ -0,0 +1,70 @@
+#ifndef CLOCK_STATS_H
+#define CLOCK_STATS_H
+
+#include "Globals.h"
+#include "Timebase.h"
+#include "SpscRing.h"
+
+#define CLOCK_STATS_BINS 8
+#define CLOCK_STATS_BIN_SHIFT 4 // The first bin is under 16us, each one after is twice as wide
+#define CLOCK_STATS_REPLY_SIZE 25 // Bytes in a stat's reply, before 7 bit encoding
+#define CLOCK_STATS_QUEUE_SIZE 8 // Interrupt measurements waiting for the main loop
+
+/* MEASUREMENTS */
+typedef enum {
+  CLOCK_STAT_IN_JITTER,       // Incoming pulse gaps compared with the tracked pulse length
+  CLOCK_STAT_SEND_TIME,       // How long forwarding a pulse takes once its handler is called
+  CLOCK_STAT_INTERNAL_JITTER, // How late the master clock's interrupt handles its pulses
+  NUM_CLOCK_STATS
+} ClockStatId_t;
+
+/* CLOCK STAT CLASS */
+// Running min, max and mean of a timing measurement in ticks, with a histogram
+// of the size of each one. Once the count fills up, everything is halved, so
+// older measurements slowly count for less.
+class ClockStat {
+private:
+  uint16_t count;
+  int16_t min;
+  int16_t max;
+  int32_t sum;
+  uint16_t bins[CLOCK_STATS_BINS];
+
+public:
+  ClockStat();
+  void reset();
+  void add(int32_t value);
+  uint8_t pack(uint8_t *out); // Write the stat out for a SysEx reply
+};
+/* END CLOCK STAT CLASS */
+
+/* CLOCK STATS CLASS */
+// Timestamps the clock pulses coming in and going out, so the timing error the
+// pedal adds can be measured on the device. The stats are read with a SysEx
+// request (F0 7D 4B 01 F7), which gets one reply per measurement:
+// F0 7D 4B 01 <7 bit encoded: id, count, min, max, mean, bins> F7
+// All the values are 16 bit little endian ticks (us).
+// The interrupts queue their measurements, so the stats are only ever changed
+// from the main loop.
+class ClockStats {
+private:
+  ClockStat stats[NUM_CLOCK_STATS];
+  SpscRing<int16_t, CLOCK_STATS_QUEUE_SIZE> internalQueue; // Filled by the master clock interrupt
+  Tick_t lastInTick; // When the last pulse came in
+  bool hasLastIn; // Is there a pulse to measure the next gap from?
+
+public:
+  ClockStats();
+  void reset();
+  void pulseIn(Tick_t now); // Call for every followed incoming pulse
+  void pulseOut(Tick_t inTick, Tick_t now); // Call once the pulse has been sent on
+  void internalPulse(int32_t lateness); // How late an internal pulse was handled, from the main loop
+  void queueInternalPulse(int32_t lateness); // The same, from the master clock interrupt
+  void refresh(); // Add the queued measurements, call regularly
+  uint8_t buildReply(uint8_t id, uint8_t *out); // SysEx reply for a stat, without F0/F7
+};
+/* END CLOCK STATS CLASS */
+
+extern ClockStats clockStats;
+
+#endif // CLOCK_STATS_H
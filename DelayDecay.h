@@ -0,0 +1,85 @@
+#ifndef DELAY_DECAY_H
+#define DELAY_DECAY_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define MAX_DELAY_REPEATS 16
+
+/* DECAY CURVES */
+enum DecayCurve {
+  DECAY_LINEAR,      // Equal velocity steps down to nothing
+  DECAY_EXPONENTIAL, // Each repeat is a fixed ratio quieter, last one is ~1/16
+  DECAY_TAPE,        // A small loss on the first repeat, then holds up and rolls off at the end
+  NUM_DECAY_CURVES
+};
+
+/* COMPILE TIME GAIN CALCULATION */
+// These are only ever evaluated by the compiler to fill in DECAY_TABLE below.
+// Gains are 0-255, where 255 is the velocity the note was played with.
+
+// e^x from its taylor series
+constexpr float decayExp(float x, uint8_t i = 1, float term = 1.0f) {
+  return i > 24 ? term : term + decayExp(x, i + 1, term * x / i);
+}
+
+constexpr uint8_t decayLinear(uint8_t total, uint8_t n) {
+  return (uint8_t)((255u * (total - n)) / total);
+}
+
+constexpr uint8_t decayExponential(uint8_t total, uint8_t n) {
+  return (uint8_t)(255.0f * decayExp(-2.7726f * n / total) + 0.5f); // 2.7726 = ln(16)
+}
+
+constexpr uint8_t decayTape(uint8_t total, uint8_t n) {
+  return (uint8_t)((230u * (total * total - n * n)) / (total * total));
+}
+
+// The gain for repeat 'n' (0 = the first repeat after release) of 'total' repeats
+constexpr uint8_t decayGain(uint8_t curve, uint8_t total, uint8_t n) {
+  return n >= total                ? 0
+         : curve == DECAY_LINEAR      ? decayLinear(total, n)
+         : curve == DECAY_EXPONENTIAL ? decayExponential(total, n)
+                                      : decayTape(total, n);
+}
+
+#define DECAY_ROW(curve, total)                                                  \
+  {decayGain(curve, total, 0),  decayGain(curve, total, 1),                      \
+   decayGain(curve, total, 2),  decayGain(curve, total, 3),                      \
+   decayGain(curve, total, 4),  decayGain(curve, total, 5),                      \
+   decayGain(curve, total, 6),  decayGain(curve, total, 7),                      \
+   decayGain(curve, total, 8),  decayGain(curve, total, 9),                      \
+   decayGain(curve, total, 10), decayGain(curve, total, 11),                     \
+   decayGain(curve, total, 12), decayGain(curve, total, 13),                     \
+   decayGain(curve, total, 14), decayGain(curve, total, 15)}
+
+#define DECAY_CURVE(curve)                                                       \
+  {DECAY_ROW(curve, 1),  DECAY_ROW(curve, 2),  DECAY_ROW(curve, 3),              \
+   DECAY_ROW(curve, 4),  DECAY_ROW(curve, 5),  DECAY_ROW(curve, 6),              \
+   DECAY_ROW(curve, 7),  DECAY_ROW(curve, 8),  DECAY_ROW(curve, 9),              \
+   DECAY_ROW(curve, 10), DECAY_ROW(curve, 11), DECAY_ROW(curve, 12),             \
+   DECAY_ROW(curve, 13), DECAY_ROW(curve, 14), DECAY_ROW(curve, 15),             \
+   DECAY_ROW(curve, 16)}
+
+/* DECAY TABLE */
+// Indexed by [curve][total repeats - 1][repeat number], stored in flash
+const uint8_t DECAY_TABLE[NUM_DECAY_CURVES][MAX_DELAY_REPEATS][MAX_DELAY_REPEATS] PROGMEM = {
+  DECAY_CURVE(DECAY_LINEAR),
+  DECAY_CURVE(DECAY_EXPONENTIAL),
+  DECAY_CURVE(DECAY_TAPE),
+};
+
+// Get the row of gains for a curve and number of repeats (1-16)
+inline const uint8_t *getDecayRow(uint8_t curve, uint8_t totalRepeats) {
+  return DECAY_TABLE[curve][totalRepeats - 1];
+}
+
+// Scale a velocity by a gain read from a decay row
+inline uint8_t applyDecay(uint8_t velocity, const uint8_t *row, uint8_t n) {
+  if (n >= MAX_DELAY_REPEATS) {
+    return 0;
+  }
+  return ((uint16_t)velocity * pgm_read_byte(row + n) + 128) >> 8;
+}
+
+#endif // DELAY_DECAY_H
@@ -1,18 +1,30 @@
 #include "Arduino.h"
 #include "Utils.h"
+#include "NoteTracker.h"
+#include "TapTempo.h"
 #include "DelayEffect.h"
 
 DelayEffect::DelayEffect() {
-  delayTimeMs = 0;
-  lastClockMs = 0;
-  clockIntervalMs = 0;
   delayNotesIdx = 0;
-  delayDivision = 1;
-  inDivisionMode = false;
-  extTapIntervalsMs[0] = 500;
-  extTapIntervalsMs[1] = 500;
+  tempoSerial = timebase.getTempoSerial();
+  tapPatternIdx = 0;
+  memcpy_P(&tapPattern, &TAP_PATTERNS[0], sizeof(DelayTapPattern_t));
+  numRepeats = 1;
+  isInitialised = false;
+  decayCurve = DECAY_LINEAR;
+  page = DELAYPAGE_REPEATS;
   delayLedOn = false;
-  clockFlag = false;
+  lastLedOnTick = 0;
+  isTransportStopped = transport.isStopped();
+  stopPos = timebase.getPosition(nowTicks());
+
+  for (uint8_t i = 0; i < MAX_DELAY_NOTES; i++) {
+    delayNotes[i].isActive = false;
+    delayNotes[i].isOn = false;
+  }
+  setDivision(DEFAULT_DELAY_DIVISION);
+
+  tapTempo.begin();
 }
 
 int8_t DelayEffect::findDelayNote(uint8_t note, uint8_t channel) {
@@ -25,45 +37,186 @@ int8_t DelayEffect::findDelayNote(uint8_t note, uint8_t channel) {
   return -1; // not found
 }
 
-void DelayEffect::resetDelayNote(uint8_t idx, uint8_t velocity, unsigned long now) {
+void DelayEffect::resetDelayNote(uint8_t idx, uint8_t velocity, Tick_t now, Pos_t pos) {
   delayNotes[idx].velocity = velocity;
   delayNotes[idx].initVelocity = velocity;
-  delayNotes[idx].lastPlayMs = now;
-  delayNotes[idx].noteOffIntervalMs = 0;
-  delayNotes[idx].noteOnMs = now;
-  delayNotes[idx].repeatsLeft = numRepeats;
+  delayNotes[idx].lastPlayPos = pos;
+  delayNotes[idx].gateLength = 0;
+  delayNotes[idx].noteOnTick = now;
+  delayNotes[idx].cyclePos = pos;
+  delayNotes[idx].nextTap = 0;
+  delayNotes[idx].repeatNum = 0;
+  delayNotes[idx].decayRow = getDecayRow(decayCurve, numRepeats);
+  scheduleDelayNote(idx);
 }
 
-  void DelayEffect::addDelayNote(uint8_t note, uint8_t velocity, uint8_t channel,
-                                  unsigned long now) {
-    DelayNote_t dn = {};
-    dn.isActive = true;
-    dn.isOn = true;
+void DelayEffect::addDelayNote(uint8_t note, uint8_t velocity, uint8_t channel,
+                                Tick_t now, Pos_t pos) {
+  // The oldest note gets overwritten, so make sure it isn't left hanging
+  DelayNote_t &old = delayNotes[delayNotesIdx];
+  if (old.isActive && old.isOn) {
+    sendMidiBoth(midi::MidiType::NoteOff, old.soundingNote, old.velocity, old.channel);
+  }
+
+  DelayNote_t dn = {};
+  dn.isActive = true;
+  dn.isOn = true;
+
+  dn.note = note;
+  dn.soundingNote = note;
+  dn.initVelocity = velocity;
+  dn.velocity = velocity;
+  dn.channel = channel;
+  dn.lastPlayPos = pos;
+
+  dn.noteOnTick = now;
+  dn.gateLength = 0;
+  dn.cyclePos = pos;
+  dn.nextTap = 0;
+  dn.repeatNum = 0;
+  dn.decayRow = getDecayRow(decayCurve, numRepeats);
+
+  delayNotes[delayNotesIdx] = dn;
+  scheduleDelayNote(delayNotesIdx);
+  delayNotesIdx = (delayNotesIdx + 1) % MAX_DELAY_NOTES;
+}
 
-    dn.note = note;
-    dn.initVelocity = velocity;
-    dn.velocity = velocity;
-    dn.channel = channel;
-    dn.lastPlayMs = now;
+void DelayEffect::decayVelocity(DelayNote_t &note) {
+  // Only reduce velocity if note has been released
+  if (note.gateLength != 0) {
+    note.repeatNum++;
+    note.velocity = applyDecay(note.initVelocity, note.decayRow, note.repeatNum);
+  }
+}
 
-    dn.noteOnMs = now;
-    dn.noteOffIntervalMs = 0;
-    dn.repeatsLeft = numRepeats;
+void DelayEffect::setDivision(uint8_t division) {
+  delayDivision = division;
+  repeatLength = DELAY_DIVISIONS[delayDivision] * POS_PER_PULSE;
+  repeatInterval = timebase.getTicksForPulses(DELAY_DIVISIONS[delayDivision]);
 
-    delayNotes[delayNotesIdx] = dn;
-    delayNotesIdx = (delayNotesIdx + 1) % MAX_DELAY_NOTES;
+  // Tap offsets only depend on the division, so work them out once here
+  // rather than for every tap
+  for (uint8_t i = 0; i < tapPattern.count; i++) {
+    tapOffsets[i] = repeatLength * tapPattern.taps[i].position / TAP_POSITIONS;
   }
 
-void DelayEffect::decayVelocity(DelayNote_t &note) {
-  // Only reduce velocity if note has been released
-  if (note.noteOffIntervalMs != 0) {
-    uint8_t step = (note.velocity + note.repeatsLeft - 1) / note.repeatsLeft;
-    note.velocity = (note.velocity > step) ? (note.velocity - step) : 0;
+  // Move any scheduled taps to the new timing
+  for (uint8_t i = 0; i < MAX_DELAY_NOTES; i++) {
+    if (delayNotes[i].isActive) {
+      scheduleDelayNote(i);
+    }
+  }
+}
+
+void DelayEffect::setTapPattern(uint8_t idx) {
+  tapPatternIdx = idx;
+  memcpy_P(&tapPattern, &TAP_PATTERNS[idx], sizeof(DelayTapPattern_t));
 
-    if (note.repeatsLeft != 0) {
-      note.repeatsLeft--;
+  // Notes past the end of the new pattern carry on from its first tap
+  for (uint8_t i = 0; i < MAX_DELAY_NOTES; i++) {
+    if (delayNotes[i].nextTap >= tapPattern.count) {
+      delayNotes[i].nextTap = 0;
+      delayNotes[i].cyclePos += repeatLength;
     }
   }
+  setDivision(delayDivision);
+}
+
+Pos_t DelayEffect::getNextTapPos(DelayNote_t &note) {
+  return note.cyclePos + tapOffsets[note.nextTap];
+}
+
+void DelayEffect::scheduleDelayNote(uint8_t idx) {
+  DelayNote_t &dn = delayNotes[idx];
+  Pos_t due = getNextTapPos(dn);
+
+  // A pending note off has to be handled before the next tap
+  if (dn.isOn && dn.gateLength > 0) {
+    Pos_t offPos = dn.lastPlayPos + dn.gateLength;
+    if (!posReached(offPos, due)) {
+      due = offPos;
+    }
+  }
+  scheduler.schedule(idx, due);
+}
+
+void DelayEffect::serviceDelayNote(uint8_t idx, Pos_t pos) {
+  DelayNote_t &dn = delayNotes[idx];
+
+  if (!dn.isActive) {
+    return;
+  }
+
+  // Note should be turned off
+  if (
+    dn.isOn &&
+    dn.gateLength > 0 &&
+    posReached(pos, dn.lastPlayPos + dn.gateLength)
+  ) {
+    dn.isOn = false;
+    sendMidiBoth(midi::MidiType::NoteOff, dn.soundingNote, dn.velocity, dn.channel);
+  }
+
+  // Next tap should be handled
+  Pos_t tapPos = getNextTapPos(dn);
+  if (posReached(pos, tapPos)) {
+
+    // Note should be turned off since velocity is < 0
+    if (dn.nextTap == 0 && dn.velocity == 0) {
+      if (dn.isOn) {
+        sendMidiBoth(midi::MidiType::NoteOff, dn.soundingNote, dn.velocity, dn.channel);
+      }
+      dn.isActive = false;
+      dn.isOn = false;
+      return; // Nothing left to schedule
+    }
+
+    // Send note off (if needed) before sending the next note on
+    if (dn.isOn) {
+      sendMidiBoth(midi::MidiType::NoteOff, dn.soundingNote, dn.velocity, dn.channel);
+      dn.isOn = false;
+    }
+
+    // Play the tap, unless it's transposed out of range
+    const DelayTap_t &tap = tapPattern.taps[dn.nextTap];
+    int16_t pitch = dn.note + tap.transpose;
+    uint8_t velocity = ((uint16_t)dn.velocity * tap.level + 128) >> 8;
+    if (pitch >= 0 && pitch <= 127 && velocity > 0) {
+      dn.soundingNote = pitch;
+      dn.isOn = true;
+      sendMidiBoth(midi::MidiType::NoteOn, dn.soundingNote, velocity, dn.channel);
+    }
+    dn.lastPlayPos = tapPos;
+
+    // Last tap of this repeat, so decay and start the next repeat. Step from the
+    // scheduled position rather than now so repeats don't drift
+    dn.nextTap++;
+    if (dn.nextTap >= tapPattern.count) {
+      dn.nextTap = 0;
+      dn.cyclePos += repeatLength;
+      decayVelocity(dn);
+    }
+
+    // Don't try to catch up on taps missed while the loop was busy
+    Pos_t nextPos = getNextTapPos(dn);
+    if (posReached(pos, nextPos)) {
+      dn.cyclePos += pos - nextPos + 1;
+    }
+  }
+
+  scheduleDelayNote(idx);
+}
+
+void DelayEffect::serviceDueNotes(Pos_t pos) {
+  if (isTransportStopped) {
+    return;
+  }
+
+  // Only the delay notes that are due get serviced
+  int16_t idx;
+  while ((idx = scheduler.popDue(pos)) != -1) {
+    serviceDelayNote(idx, pos);
+  }
 }
 
 void DelayEffect::handleMidiMessage(
@@ -78,52 +231,59 @@ void DelayEffect::handleMidiMessage(
     break;
   case midi::MidiType::ActiveSensing: // Has seperate handler
     break;
-  case midi::MidiType::Continue: // Send continue
-    sendMidiContinue();
+  case midi::MidiType::Continue: // Has seperate handler
     break;
-  case midi::MidiType::Start: // Send start
-    sendMidiStart();
+  case midi::MidiType::Start: // Has seperate handler
     break;
-  case midi::MidiType::Stop: // Send stop
-    sendMidiStop();
+  case midi::MidiType::Stop: // Has seperate handler
     break;
   case midi::MidiType::NoteOn: {
     int8_t idx = findDelayNote(data1, channel);
 
-    // Pedal is active
-    if (isActive) {
-      unsigned long now = millis();
+    // Pedal is active (notes played while stopped aren't repeated)
+    if (isActive && !isTransportStopped) {
+      Tick_t now = nowTicks();
+      Pos_t pos = timebase.getPosition(now);
 
       // Reset the note (if found) or add it
       if (idx != -1) {
-        resetDelayNote(idx, data2, now);
-
         // Turn off if already on
         if (delayNotes[idx].isOn) {
-          sendMidiBoth(midi::MidiType::NoteOff, data1, data2, channel);
+          sendMidiBoth(midi::MidiType::NoteOff, delayNotes[idx].soundingNote, data2, channel);
         }
+        delayNotes[idx].isOn = true;
+        delayNotes[idx].soundingNote = data1;
+        resetDelayNote(idx, data2, now, pos);
       } else {
-        addDelayNote(data1, data2, channel, now);
+        addDelayNote(data1, data2, channel, now, pos);
       }
-
     }
-    delayNotes[idx].isOn = true;
     sendMidiBoth(type, data1, data2, channel);
     break;
   }
   case midi::MidiType::NoteOff: {
     int8_t idx = findDelayNote(data1, channel);
 
-    // Pedal active, note found, and note is active
-    if (isActive) {
-      if (idx != -1 && delayNotes[idx].isActive) {
-        delayNotes[idx].noteOffIntervalMs = millis() - delayNotes[idx].noteOnMs;
-      }
-
-      if (!delayNotes[idx].isOn) {
+    // Pedal active and note found, so the delay note will turn itself off.
+    // While stopped, only a recorded note that's still held counts
+    bool isRecorded = idx != -1 && !(isTransportStopped && delayNotes[idx].gateLength > 0);
+    if (isActive && isRecorded) {
+      // Hold the repeats for as long as the note was held, measured in
+      // positions so the gate follows the clock
+      Pos_t held = timebase.ticksToPos(nowTicks() - delayNotes[idx].noteOnTick);
+      delayNotes[idx].gateLength = held > 0 ? held : 1;
+
+      // Repeats start decaying from the first one after release
+      delayNotes[idx].repeatNum = 0;
+      delayNotes[idx].velocity = applyDecay(delayNotes[idx].initVelocity,
+                                            delayNotes[idx].decayRow, 0);
+
+      // Nothing's serviced while stopped, so end the held note now
+      if (isTransportStopped && delayNotes[idx].isOn) {
         delayNotes[idx].isOn = false;
-        sendMidiBoth(type, data1, data2, channel);
+        sendMidiBoth(type, delayNotes[idx].soundingNote, data2, channel);
       }
+      scheduleDelayNote(idx);
     } else {
       sendMidiBoth(type, data1, data2, channel);
     }
@@ -135,138 +295,92 @@ void DelayEffect::handleMidiMessage(
   }
 }
 
-void DelayEffect::process(State_t *state) {
-  unsigned long now = millis();
-
-  // Initialise the numRepeats on the first call
-  static bool initialised = false;
-  if (!initialised) {
-    numRepeats = state->rotaryPos;
-    initialised = true;
-  }
-
-  if (clockFlag) {
-    hardwareMIDI.sendClock();
-    usbMIDI.sendClock();
+void DelayEffect::updateLed(State_t *state) {
+  Tick_t now = nowTicks();
 
-    unsigned long now = millis();
-    clockIntervalMs = now - lastClockMs;
-    delayTimeMs = clockIntervalMs * MIDI_CLOCKS_PER_QUARTER;
-    lastClockMs = now;
-    clockFlag = false;
+  // Only recalculate the LED interval when the tempo has actually changed
+  if (tempoSerial != timebase.getTempoSerial()) {
+    tempoSerial = timebase.getTempoSerial();
+    repeatInterval = timebase.getTicksForPulses(DELAY_DIVISIONS[delayDivision]);
   }
 
   if (state->isActive) {
-    if (inDivisionMode) {
-      setLed(127, 127, 127); // Light blue
-    } else if (delayLedOn && (now - lastLedOnTime) > (delayTimeMs/(float)delayDivision)/2) {
+    if (page == DELAYPAGE_DIVISION) {
+      setLed(127, 127, 127); // White
+    } else if (page == DELAYPAGE_DECAY) {
+      setLed(127, 0, 127); // Purple
+    } else if (page == DELAYPAGE_TAPS) {
+      setLed(0, 127, 0); // Green
+    } else if (delayLedOn && (now - lastLedOnTick) > repeatInterval/2) {
       setLed(0, 0, 0);
       delayLedOn = false;
-    } else if (!delayLedOn && (now - lastLedOnTime) > (delayTimeMs/(float)delayDivision)) {
+    } else if (!delayLedOn && (now - lastLedOnTick) > repeatInterval) {
       setLed(127, 127, 0); // Yellow
       delayLedOn = true;
-      lastLedOnTime = now;
+      lastLedOnTick = now;
     } else if (!delayLedOn) {
       setLed(0, 0, 255); // Blue
     }
   } else {
     setLed(0, 0, 0);
   }
+}
+
+void DelayEffect::handleControls(State_t *state) {
+  // Initialise the numRepeats on the first call
+  if (!isInitialised) {
+    numRepeats = state->rotaryPos+1;
+    isInitialised = true;
+  }
 
   if (state->rotaryMoved) {
-    if (inDivisionMode) {
-      delayDivision = state->rotaryPos+1; // Add 1 so we don't get divide by 0 error
-    } else {
+    switch (page) {
+    case DELAYPAGE_DIVISION:
+      setDivision(state->rotaryPos);
+      break;
+    case DELAYPAGE_DECAY:
+      if (state->rotaryPos < NUM_DECAY_CURVES) {
+        decayCurve = state->rotaryPos;
+      }
+      break;
+    case DELAYPAGE_TAPS:
+      if (state->rotaryPos < NUM_TAP_PATTERNS) {
+        setTapPattern(state->rotaryPos);
+      }
+      break;
+    default:
       numRepeats = state->rotaryPos+1;
+      break;
     }
   }
 
-  // The ext footswitch hasn't been pressed recently, so use the current time as the last ext tap
-  if (now - lastExtTapMs > EXT_TIMEOUT) {
-    lastExtTapMs = now;
-  }
-
-  // Clock hasn't been recieved recently, so use the ext footswitch as clock source
-  if (now - lastClockMs > CLOCK_TIMEOUT) {
-    delayTimeMs = (extTapIntervalsMs[0] + extTapIntervalsMs[1]) / 2; // Average out taps 
-  }
-
-  switch (state->extEvent) {
-  case Click: // Shuffle the last tap over, and add the current tap interval
-    extTapIntervalsMs[1] = extTapIntervalsMs[0];
-    extTapIntervalsMs[0] = now - lastExtTapMs;
-    lastExtTapMs = now;
-    break;
-  default: 
-    break;
+  // Ext footswitch taps set the tempo used when no clock has been recieved recently
+  if (tapTempo.update()) {
+    timebase.setInternalQuarter(tapTempo.getQuarterTicks());
   }
 
   switch (state->stompEvent) {
   case Click:
-    if (inDivisionMode) {
-      inDivisionMode = false;
+    if (page != DELAYPAGE_REPEATS) {
+      page = DELAYPAGE_REPEATS;
     } else {
       state->isActive = !state->isActive;
     }
     break;
   case LongPress:
     if (state->isActive) {
-      inDivisionMode = !inDivisionMode;
+      page = (DelayPage_t)((page + 1) % NUM_DELAYPAGE);
     }
     break;
   default:
     break;
   }
+}
 
-  for (uint8_t i = 0; i < MAX_DELAY_NOTES; i++) {
-    DelayNote_t dn = delayNotes[i];
-
-    if (delayNotes[i].isActive) {
-      
-      // Note should be turned off
-      if (
-        delayNotes[i].isOn && 
-        delayNotes[i].noteOffIntervalMs > 0 && 
-        (now - delayNotes[i].lastPlayMs) > delayNotes[i].noteOffIntervalMs
-      ) {
-        delayNotes[i].isOn = false; // Modify the original delay note
-        sendMidiBoth(midi::MidiType::NoteOff, delayNotes[i].note, 
-                      delayNotes[i].velocity, delayNotes[i].channel);
-      }
-
-      // Next delay should be handled
-      if ((now - delayNotes[i].lastPlayMs) > delayTimeMs/(float)delayDivision) {
-
-        // Note should delay again with less velocity
-        if (delayNotes[i].velocity > 0) {
-
-          // Send note off (if needed) before sending note on again 
-          if (delayNotes[i].isOn) {
-            sendMidiBoth(midi::MidiType::NoteOff, delayNotes[i].note, 
-                          delayNotes[i].velocity, delayNotes[i].channel);
-          }
-          delayNotes[i].isOn = true;
-          sendMidiBoth(midi::MidiType::NoteOn, delayNotes[i].note, 
-                        delayNotes[i].velocity, delayNotes[i].channel);
-
-          // Decay the velocity
-          decayVelocity(delayNotes[i]);
-
-          // Set note's state variables
-          delayNotes[i].lastPlayMs = now;
-
-        // Note should be turned off since velocity is < 0
-        } else {
-          delayNotes[i].isActive = false;
-          delayNotes[i].isOn = false;
-          sendMidiBoth(midi::MidiType::NoteOff, delayNotes[i].note, 
-                        delayNotes[i].velocity, delayNotes[i].channel);
-        }
-      }
-    }
-  }
+void DelayEffect::process(State_t *state) {
+  serviceDueNotes(timebase.getPosition(nowTicks()));
 
-  if (usbMIDI.read()) {
+  if (usbMIDI.read() && !isRoutedMessage(usbMIDI.getType())) {
     if (usbMIDI.getChannel() == state->midiChannel) {
       handleMidiMessage(state->isActive, usbMIDI.getType(), usbMIDI.getData1(),
                       usbMIDI.getData2(), usbMIDI.getChannel());
@@ -276,7 +390,7 @@ void DelayEffect::process(State_t *state) {
     
   }
 
-  if (hardwareMIDI.read()) {
+  if (hardwareMIDI.read() && !isRoutedMessage(hardwareMIDI.getType())) {
     if (hardwareMIDI.getChannel() == state->midiChannel) {
       handleMidiMessage(state->isActive, hardwareMIDI.getType(), hardwareMIDI.getData1(),
                       hardwareMIDI.getData2(), hardwareMIDI.getChannel());
@@ -287,16 +401,66 @@ void DelayEffect::process(State_t *state) {
 }
 
 void DelayEffect::handlePanic() {
-  for (uint8_t i = 0; i < delayNotesIdx; i++) {
+  for (uint8_t i = 0; i < MAX_DELAY_NOTES; i++) {
     delayNotes[i].isActive = false;
     delayNotes[i].isOn = false;
   }
-  for (uint8_t i = 0; i < 16; i++) { // 16 midi channels total
-    sendMidiBoth(midi::MidiType::ControlChange, midi::AllNotesOff, 0, i+1);
-    
-  }
+  scheduler.clear();
+  noteTracker.releaseAll();
 }
 
 void DelayEffect::handleClock() {
-  clockFlag = true;
-}
\ No newline at end of file
+  // Service straight away so repeats land on the pulse they're due on
+  serviceDueNotes(timebase.getPosition(nowTicks()));
+}
+
+void DelayEffect::handleTransport(TransportEvent_t event) {
+  Pos_t pos = timebase.getPosition(nowTicks());
+
+  if (event == TRANSPORT_EVENT_STOP) {
+    if (isTransportStopped) return;
+    isTransportStopped = true;
+    stopPos = pos;
+
+    // Silence the repeats, notes that are still held keep sounding
+    for (uint8_t i = 0; i < MAX_DELAY_NOTES; i++) {
+      DelayNote_t &dn = delayNotes[i];
+      if (dn.isActive && dn.isOn && dn.gateLength > 0) {
+        sendMidiBoth(midi::MidiType::NoteOff, dn.soundingNote, dn.velocity, dn.channel);
+        dn.isOn = false;
+      }
+    }
+    return;
+  }
+
+  // Playing again, so carry the repeats on from where they were stopped
+  if (!isTransportStopped) return;
+  isTransportStopped = false;
+  Pos_t shift = pos - stopPos;
+  for (uint8_t i = 0; i < MAX_DELAY_NOTES; i++) {
+    DelayNote_t &dn = delayNotes[i];
+    if (dn.isActive) {
+      dn.cyclePos += shift;
+      dn.lastPlayPos += shift;
+      scheduleDelayNote(i);
+    }
+  }
+}
+
+void DelayEffect::savePreset(Preset_t &preset) {
+  preset.repeats = numRepeats;
+  preset.division = delayDivision;
+  preset.decay = decayCurve;
+  preset.taps = tapPatternIdx;
+}
+
+void DelayEffect::loadPreset(const Preset_t &preset, State_t *state) {
+  if (preset.repeats >= 1 && preset.repeats <= 16) {
+    numRepeats = preset.repeats;
+    isInitialised = true; // Don't take it from the rotary now
+  }
+  if (preset.division < NUM_DELAY_DIVISIONS) setDivision(preset.division);
+  if (preset.decay < NUM_DECAY_CURVES) decayCurve = preset.decay;
+  if (preset.taps < NUM_TAP_PATTERNS) setTapPattern(preset.taps);
+  page = DELAYPAGE_REPEATS;
+}
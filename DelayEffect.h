@@ -3,59 +3,140 @@
 
 #include "Globals.h"
 #include "BaseEffect.h"
+#include "TimerHeap.h"
+#include "Timebase.h"
+#include "DelayDecay.h"
 
 #define MAX_DELAY_NOTES 30
+#define MAX_DELAY_TAPS 4
+
+/* DELAY DIVISIONS */
+// Repeat lengths in midi clock pulses (24 per quarter note)
+#define NUM_DELAY_DIVISIONS 16
+#define DEFAULT_DELAY_DIVISION 5
+const uint8_t DELAY_DIVISIONS[NUM_DELAY_DIVISIONS] = {
+  96, // 1/1
+  72, // 1/2 dotted
+  48, // 1/2
+  36, // 1/4 dotted
+  32, // 1/2 triplet
+  24, // 1/4
+  18, // 1/8 dotted
+  16, // 1/4 triplet
+  12, // 1/8
+  9,  // 1/16 dotted
+  8,  // 1/8 triplet
+  6,  // 1/16
+  4,  // 1/16 triplet
+  3,  // 1/32
+  2,  // 1/32 triplet
+  1,  // 1/64 triplet
+};
+
+#define TAP_POSITIONS 24 // Tap positions are in 1/24ths of a repeat
+
+/* DELAY TAPS */
+typedef struct {
+  uint8_t position; // When the tap plays, in 1/24ths of the repeat interval
+  uint8_t level;    // Velocity scale for this tap, 0-255
+  int8_t transpose; // Semitone offset from the recorded note
+} DelayTap_t;
+
+typedef struct {
+  uint8_t count; // Number of taps
+  DelayTap_t taps[MAX_DELAY_TAPS]; // Taps in the order they play
+} DelayTapPattern_t;
+
+#define NUM_TAP_PATTERNS 8
+const DelayTapPattern_t TAP_PATTERNS[NUM_TAP_PATTERNS] PROGMEM = {
+  {1, {{24, 255, 0}}},                                          // Single repeat
+  {2, {{12, 160, 0}, {24, 255, 0}}},                            // Half way ghost
+  {3, {{8, 140, 0}, {16, 190, 0}, {24, 255, 0}}},               // Triplet taps
+  {4, {{6, 110, 0}, {12, 150, 0}, {18, 200, 0}, {24, 255, 0}}}, // Even taps
+  {1, {{24, 255, 12}}},                                         // Octave up
+  {2, {{12, 200, 12}, {24, 255, 0}}},                           // Octave ghost
+  {2, {{12, 200, 7}, {24, 255, 0}}},                            // Fifth ghost
+  {3, {{8, 220, 0}, {16, 180, 7}, {24, 150, 12}}},              // Rising root, 5th, oct
+};
 
 typedef struct {
   bool isActive;            // If the note still has some velocity, it's active
-  bool isOn;                // Note is currently playing
+  bool isOn;                // A note from this delay note is currently playing
   uint8_t note;             // MIDI note number
+  uint8_t soundingNote;     // The note that's playing (differs from note on transposed taps)
   uint8_t initVelocity;     // MIDI note velocity when recorded
   uint8_t velocity;         // Current MIDI note velocity (decays per repeat)
   uint8_t channel;          // MIDI channel note was played on
-  unsigned long lastPlayMs; // When the note was LAST turned on
-  unsigned long noteOnMs;   // When the note was INITIALLY turned on
-  unsigned long noteOffIntervalMs; // The interval between the initial note
-                                   // record, and when it was released
-  uint8_t repeatsLeft; // The number of repeats left for this note
+  Tick_t noteOnTick;   // When the note was INITIALLY turned on
+  Pos_t lastPlayPos;   // Position the note was LAST turned on at
+  Pos_t gateLength;    // How long the note was held for before it was
+                       // released, 0 while still held
+  Pos_t cyclePos;      // Position the current repeat started at, taps are offset from this
+  uint8_t nextTap;     // The index of the next tap to play in the current repeat
+  uint8_t repeatNum;   // The number of repeats played since the note was released
+  const uint8_t *decayRow; // The decay table row (curve and number of repeats) for this note
 } DelayNote_t;
 
+/* DELAY PAGES */
+// Long press steps through the pages, the rotary sets the page's value
+typedef enum {
+  DELAYPAGE_REPEATS,  // Rotary selects number of repeats
+  DELAYPAGE_DIVISION, // Rotary selects note division
+  DELAYPAGE_DECAY,    // Rotary selects the decay curve
+  DELAYPAGE_TAPS,     // Rotary selects the tap pattern
+  NUM_DELAYPAGE
+} DelayPage_t;
+
 class DelayEffect : public BaseEffect {
 private:
-  volatile unsigned long delayTimeMs; // How long each delay is
-  uint8_t delayDivision; // How much to divide the delayTime by (1-16)
+  uint8_t delayDivision; // Index into DELAY_DIVISIONS
+  Pos_t repeatLength; // The length of a repeat
+  Tick_t repeatInterval; // The length of a repeat in ticks, used for the clock LED
+  uint8_t tempoSerial; // The timebase tempo the repeat interval was calculated from
   uint8_t numRepeats; // The number of repeats for the delay (1-16)
-  bool inDivisionMode; // If the pedal is in division mode
-
-  /* Clock Input */
-  volatile unsigned long lastClockMs; // The last clock pulse time
-  volatile unsigned long clockIntervalMs; // The interval between clock pulses
-  bool clockFlag;
+  uint8_t decayCurve; // The DecayCurve used for new notes
+  uint8_t tapPatternIdx; // Index into TAP_PATTERNS
+  DelayTapPattern_t tapPattern; // A copy of the taps played for every repeat
+  Pos_t tapOffsets[MAX_DELAY_TAPS]; // Each tap's offset from the start of a repeat
+  DelayPage_t page; // What the rotary is currently editing
+  bool isInitialised; // Has the number of repeats been taken from the rotary yet?
 
-  /* External footswitch tempo input */
-  unsigned long extTapIntervalsMs[2]; // the last two (2) recorded ext footswitch tap intervals
-  unsigned long lastExtTapMs; // Use this to calculate the intervals above
+  /* Transport */
+  bool isTransportStopped; // Frozen by a midi Stop
+  Pos_t stopPos; // Where the Stop happened, the repeats carry on from here
 
   /* Delay note array and array index */
   DelayNote_t delayNotes[MAX_DELAY_NOTES]; // the last 30 notes stored for delay
   uint8_t delayNotesIdx; // The current index of the next free slot
+  TimerHeap<MAX_DELAY_NOTES> scheduler; // The next due position of each active delay note
 
   /* Clock LED */
   bool delayLedOn;
-  unsigned long lastLedOnTime;
+  Tick_t lastLedOnTick;
 
   int8_t findDelayNote(uint8_t note, uint8_t channel);
-  void resetDelayNote(uint8_t idx, uint8_t velocity, unsigned long now);
+  void resetDelayNote(uint8_t idx, uint8_t velocity, Tick_t now, Pos_t pos);
   void addDelayNote(uint8_t note, uint8_t velocity, uint8_t channel,
-                    unsigned long now);
+                    Tick_t now, Pos_t pos);
   void decayVelocity(DelayNote_t &note);
+  void setDivision(uint8_t division);
+  void setTapPattern(uint8_t idx);
+  Pos_t getNextTapPos(DelayNote_t &note);
+  void scheduleDelayNote(uint8_t idx);
+  void serviceDelayNote(uint8_t idx, Pos_t pos);
+  void serviceDueNotes(Pos_t pos);
   void handleMidiMessage(bool isActive, midi::MidiType type, midi::DataByte data1,
                           midi::DataByte data2, midi::Channel channel);
 public:
   DelayEffect();
   void process(State_t *state) override;
+  void handleControls(State_t *state) override;
+  void updateLed(State_t *state) override;
   void handlePanic() override;
   void handleClock() override;
+  void savePreset(Preset_t &preset) override;
+  void loadPreset(const Preset_t &preset, State_t *state) override;
+  void handleTransport(TransportEvent_t event) override;
 };
 
 #endif // DELAY_H
\ No newline at end of file
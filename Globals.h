@@ -4,6 +4,8 @@
 #include <MIDI.h>
 #include <USB-MIDI.h>
 #include <stdint.h>
+#include "MidiSerial.h"
+#include "SysExThru.h"
 
 /* SWITCHES */
 #define SW_PIN 2
@@ -27,7 +29,6 @@
 
 /* TIMEOUTS */
 #define CLOCK_TIMEOUT 1000
-#define EXT_TIMEOUT 5000
 
 /* EFFECTS */
 enum Effects {
@@ -37,6 +38,7 @@ enum Effects {
   E_CHORDGEN_B3,
   E_DELAY,
   E_ARP,
+  E_CLOCKDIV,
   NUM_EFFECTS
 };
 
@@ -62,24 +64,57 @@ typedef struct {
 
 /* EEPROM SAVE LOCATIONS */
 // NOTE: The save locations are 1 byte (8 bits) long
+// These are where the settings were saved before the Settings ring (Settings.h),
+// they're only read to import the settings the first time
 #define EEPROM_EFFECT 0x00 // The currently active effect
 #define EEPROM_MUTE_BASE 0x10 // Midi mute location (takes 16 * 8bits space)
 #define EEPROM_ARP_BASE 0x50 // Step save location
 #define EEPROM_ARP_HOLD_OFFSET 0x10 // Used with arp base to get the current hold state
+#define EEPROM_ARP_GATE_OFFSET 0x11 // Used with arp base to get the gate length
+#define EEPROM_ARP_SWING_OFFSET 0x12 // Used with arp base to get the swing amount
+#define EEPROM_ARP_RETRIGGER_OFFSET 0x13 // Used with arp base to get the chord retrigger setting
 #define EEPROM_MIDI_CHANNEL 0x80 // MIDI channel in/out location
+#define EEPROM_CLOCK_OUT 0x81 // Send midi clock when there is no clock in
+#define EEPROM_CLOCKDIV_RATIO 0x82 // The clock divider's ratio
 
 /* TIMERS */
 #define LONG_PRESS 1000
 #define RESET_PRESS 3000
 #define LED_TIME_MS 1000
+#define LED_TASK_MS 20 // How often the effect updates the LED
+#define HOUSEKEEPING_TASK_MS 10 // How often the clock and transport timeouts are checked
 
 /* MIDI */
 #define MIDI_CLOCKS_PER_QUARTER 24
+#define MIDI_CLOCKS_PER_BEAT 6 // Song Position counts in 1/16 notes
+
+/* SYSEX */
+// Requests look like F0 7D 4B <command> ... F7 (7D is the non-commercial ID)
+#define SYSEX_ID 0x7D
+#define SYSEX_DEVICE 0x4B // 'K'
+#define SYSEX_HEADER_SIZE 4 // F0, ID, device, command
+#define SYSEX_CLOCK_STATS 0x01 // Reply with the clock stats
+#define SYSEX_CLOCK_STATS_RESET 0x02 // Start the clock stats again
+#define SYSEX_TASK_STATS 0x03 // Reply with the main loop task run times
+#define SYSEX_TASK_STATS_RESET 0x04 // Start the task run times again
+#define SYSEX_PRESET_STORE 0x05 // <slot> Store the pedal's current setup as a preset
+#define SYSEX_PRESET_DUMP 0x06 // <slot> Reply with the preset, 7 bit encoded
+#define SYSEX_PRESET_WRITE 0x07 // <slot> <7 bit encoded preset> Store a dumped preset
+
+/* MIDI SETTINGS */
+// SysEx is taken out before it gets to the library (SysExThru.h), so its
+// SysEx buffer is never used
+struct MidiSettings : public midi::DefaultSettings {
+  static const unsigned SysExMaxSize = 8;
+};
 
 /* HARDWARE MIDI */
-extern midi::MidiInterface<midi::SerialMIDI<HardwareSerial>> hardwareMIDI;
+typedef SysExFilter<midi::SerialMIDI<MidiSerial>> DinTransport_t;
+extern midi::MidiInterface<DinTransport_t, MidiSettings> hardwareMIDI;
 
 /* USB MIDI */
-extern midi::MidiInterface<usbMidi::usbMidiTransport> usbMIDI;
+#define USB_MIDI_CABLE 1
+typedef SysExFilter<usbMidi::usbMidiTransport> UsbTransport_t;
+extern midi::MidiInterface<UsbTransport_t, MidiSettings> usbMIDI;
 
 #endif // GLOBALS_H
@@ -0,0 +1,106 @@
+#include "Arduino.h"
+#include "MasterClock.h"
+#include "ClockStats.h"
+#include <util/atomic.h>
+
+MasterClock::MasterClock() {
+  isRunning = false;
+  nextPulseTick = 0;
+  lastPulseTick = 0;
+  pulsePeriodQ8 = (500 * TICKS_PER_MS << TICK_FRAC_BITS) / MIDI_CLOCKS_PER_QUARTER;
+  pulseRemainder = 0;
+  takenPulses = 0;
+  usbQueued = 0;
+  usbSent = 0;
+  isOutputOn = false;
+}
+
+void MasterClock::begin() {
+  TIFR0 = _BV(OCF0B); // Clear any old match
+  TIMSK0 |= _BV(OCIE0B);
+}
+
+void MasterClock::start(Tick_t now, uint32_t periodQ8) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pulsePeriodQ8 = periodQ8;
+    pulseRemainder = 0;
+    lastPulseTick = now;
+    nextPulseTick = now + (periodQ8 >> TICK_FRAC_BITS);
+    isRunning = true;
+  }
+}
+
+void MasterClock::stop() {
+  // No more pulses can be counted once it's stopped, so drop the ones left
+  isRunning = false;
+  takenPulses = pulses.read().count;
+}
+
+void MasterClock::setPulsePeriodQ8(uint32_t periodQ8) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // Move the pulse that's already scheduled too, so a slower tempo takes
+    // effect straight away
+    if (isRunning) {
+      nextPulseTick = lastPulseTick + (periodQ8 >> TICK_FRAC_BITS);
+    }
+    pulsePeriodQ8 = periodQ8;
+  }
+}
+
+void MasterClock::setOutput(bool state) { isOutputOn = state; }
+
+bool MasterClock::getOutput() { return isOutputOn; }
+
+bool MasterClock::getIsRunning() { return isRunning; }
+
+void MasterClock::scheduleCompare(Tick_t now) {
+  // Only a pulse in the next timer period can be set up exactly, otherwise
+  // just check again next period
+  if ((nextPulseTick >> TIMER0_PERIOD_SHIFT) == (now >> TIMER0_PERIOD_SHIFT) + 1) {
+    OCR0B = (nextPulseTick >> TIMER0_COUNT_SHIFT) & 0xFF;
+  }
+}
+
+void MasterClock::handleTimer() {
+  if (!isRunning) {
+    return;
+  }
+
+  Tick_t now = micros();
+  while (tickReached(now + MASTER_CLOCK_EARLY, nextPulseTick)) {
+    lastPulseTick = nextPulseTick;
+    uint16_t remainder = pulseRemainder + (pulsePeriodQ8 & 0xFF);
+    nextPulseTick += (pulsePeriodQ8 >> TICK_FRAC_BITS) + (remainder >> TICK_FRAC_BITS);
+    pulseRemainder = remainder & 0xFF;
+
+    ClockPulses_t published = {(uint8_t)(pulses.peek().count + 1), lastPulseTick};
+    pulses.write(published);
+
+    if (isOutputOn) {
+      midiSerial.sendClock();
+      if ((uint8_t)(usbQueued - usbSent) < 0xFF) usbQueued++;
+    }
+    clockStats.queueInternalPulse(now - lastPulseTick);
+  }
+
+  scheduleCompare(now);
+}
+
+uint8_t MasterClock::takePulses(Tick_t &lastTick) {
+  ClockPulses_t snapshot = pulses.read();
+  uint8_t count = snapshot.count - takenPulses;
+  takenPulses = snapshot.count;
+  lastTick = snapshot.lastTick;
+  return count;
+}
+
+void MasterClock::sendPending() {
+  while (usbSent != usbQueued) {
+    usbMIDI.sendClock();
+    usbSent++;
+  }
+}
+
+ISR(TIMER0_COMPB_vect) {
+  masterClock.handleTimer();
+}
@@ -0,0 +1,65 @@
+#ifndef MASTER_CLOCK_H
+#define MASTER_CLOCK_H
+
+#include "Globals.h"
+#include "Timebase.h"
+#include "Seqlock.h"
+
+#define TIMER0_PERIOD_SHIFT 10 // One Timer0 period is 1024 ticks (256 counts of 4us)
+#define TIMER0_COUNT_SHIFT 2   // One Timer0 count is 4 ticks
+#define MASTER_CLOCK_EARLY 8   // A pulse this many ticks away counts as due (2 counts)
+
+// What the interrupt publishes for the main loop after every pulse
+typedef struct {
+  uint8_t count; // Pulses so far, wraps at 256
+  Tick_t lastTick; // When the last one was due
+} ClockPulses_t;
+
+/* MASTER CLOCK CLASS */
+// Generates 24 PPQN clock pulses from a Timer0 compare interrupt when there's
+// no midi clock coming in. Timer0 already runs millis()/micros(), one count
+// every 4us and an overflow every 1024us, so the compare B interrupt is free
+// to use without touching the timers the LEDs use.
+// The compare register only updates at the start of a timer period, so each
+// interrupt sets it up for the period after, where the next pulse is due.
+// The pulses are counted for the main loop, which moves the timebase on. If
+// clock output is on, the interrupt sends the DIN clock itself (MidiSerial.h)
+// so it doesn't wait on the main loop. USB can't be written from an interrupt,
+// so its pulses are counted for the main loop to send.
+// The interrupt only ever adds to its counts and the main loop keeps its own
+// count of what it has taken, so the main loop never turns interrupts off to
+// take the pulses (only to change the tempo).
+class MasterClock {
+private:
+  volatile bool isRunning;
+  volatile Tick_t nextPulseTick; // When the next pulse is due
+  volatile Tick_t lastPulseTick; // When the last pulse was due
+  volatile uint32_t pulsePeriodQ8; // The length of one pulse in ticks (Q24.8)
+  volatile uint8_t pulseRemainder; // Fraction of a tick carried between pulses
+  Seqlock<ClockPulses_t> pulses; // Written by the interrupt
+  uint8_t takenPulses; // The pulse count the main loop has got up to
+  volatile uint8_t usbQueued; // USB pulses the interrupt left for the main loop, wraps
+  volatile uint8_t usbSent; // How many of those the main loop has sent
+  bool isOutputOn; // Send the pulses as midi clock?
+
+  void scheduleCompare(Tick_t now);
+
+public:
+  MasterClock();
+  void begin(); // Enable the Timer0 compare interrupt
+  void start(Tick_t now, uint32_t periodQ8); // Start generating pulses from now
+  void stop();
+  void setPulsePeriodQ8(uint32_t periodQ8);
+  void setOutput(bool state);
+  bool getOutput();
+  bool getIsRunning();
+
+  void handleTimer(); // Called from the Timer0 compare B interrupt
+  uint8_t takePulses(Tick_t &lastTick); // The pulses since last time, and when the last was due
+  void sendPending(); // Send the USB clock for the pulses since last time
+};
+/* END MASTER CLOCK CLASS */
+
+extern MasterClock masterClock;
+
+#endif // MASTER_CLOCK_H
@@ -1,27 +1,128 @@
 #include "Globals.h"
-#include "EEPROM.h"
+#include "Settings.h"
+#include "Presets.h"
 #include "Utils.h"
 #include "Switches.h"
+#include "TapTempo.h"
+#include "Timebase.h"
+#include "MasterClock.h"
+#include "TempoTracker.h"
+#include "ClockArbiter.h"
+#include "Transport.h"
+#include "ClockMultiplier.h"
+#include "ClockStats.h"
+#include "NoteTracker.h"
+#include "TaskScheduler.h"
 
 #include "BaseEffect.h"
 #include "MidiMuteEffect.h"
 #include "ChordGenEffect.h"
 #include "DelayEffect.h"
 #include "ArpEffect.h"
+#include "ClockDivEffect.h"
+
+/* SAVED SETTINGS */
+Settings settings;
+Presets presets;
 
 /* MIDI INIT */
-MIDI_CREATE_INSTANCE(HardwareSerial, Serial1, hardwareMIDI);
-USBMIDI_CREATE_INSTANCE(1, usbMIDI);
+// Each input goes through a SysExFilter, which streams SysEx straight through
+MidiSerial midiSerial;
+midi::SerialMIDI<MidiSerial> dinSerial(midiSerial);
+DinTransport_t dinTransport(dinSerial, CLOCK_SOURCE_DIN);
+midi::MidiInterface<DinTransport_t, MidiSettings> hardwareMIDI(dinTransport);
+usbMidi::usbMidiTransport usbPort(USB_MIDI_CABLE);
+UsbTransport_t usbTransport(usbPort, CLOCK_SOURCE_USB);
+midi::MidiInterface<UsbTransport_t, MidiSettings> usbMIDI(usbTransport);
+SysExThru sysExThru;
 
 /* SWITCHES */
+InputScanner inputScanner;
 EventSwitch stompSwitch(SW_PIN, INPUT_PULLUP);
 EventSwitch extSwitch(EXT_SW_PIN, INPUT_PULLUP);
+TapTempo tapTempo(EXT_SW_PIN);
 RotarySwitch rotarySwitch(ROT_A_PIN, ROT_B_PIN, ROT_C_PIN, 
                           ROT_D_PIN, INPUT_PULLUP);
 
+/* TIMEBASE */
+MasterClock masterClock;
+TempoTracker tempoTracker;
+ClockArbiter clockArbiter;
+Transport transport;
+ClockMultiplier clockMultiplier;
+ClockStats clockStats;
+Timebase timebase;
+
+/* SOUNDING NOTES */
+NoteTracker noteTracker;
+
+/* MAIN LOOP TASKS */
+TaskScheduler taskScheduler;
+
 /* STATES */
 State_t pedalState;
 BaseEffect* currentEffect = nullptr;
+uint8_t pendingPreset = PRESET_IDLE; // Recalled once the effect has finished with the midi in
+uint8_t pendingDump = PRESET_IDLE; // Preset slot a SysEx request asked for
+ClockSource_t pendingDumpSource = CLOCK_SOURCE_DIN; // The input it came in on
+
+/* EFFECTS */
+// This probably isn't the best way to do this, but it
+// means that only one effect is instantiated at any one time
+BaseEffect* createEffect(uint8_t idx) {
+  switch (idx) {
+  case 0:
+    return new MidiMuteEffect();
+  case 1:
+    return new ChordGenEffect(1);
+  case 2:
+    return new ChordGenEffect(2);
+  case 3:
+    return new ChordGenEffect(3);
+  case 4:
+    return new DelayEffect();
+  case 5:
+    return new ArpEffect();
+  case 6:
+    return new ClockDivEffect();
+  default:
+    return new MidiMuteEffect(); // Default to MidiMute if out of range
+  }
+}
+
+void switchEffect(uint8_t idx) {
+  delete currentEffect;
+  currentEffect = createEffect(idx);
+  pedalState.effectIdx = idx;
+  settings.setEffect(idx);
+}
+
+/* PRESETS */
+void capturePreset(Preset_t &preset) {
+  memset(&preset, 0, sizeof(preset));
+  preset.effect = pedalState.effectIdx;
+  preset.midiChannel = pedalState.midiChannel;
+  preset.isActive = pedalState.isActive;
+  currentEffect->savePreset(preset);
+}
+
+void recallPreset(uint8_t slot) {
+  Preset_t preset;
+  if (!presets.load(slot, preset) || preset.effect >= NUM_EFFECTS) return;
+
+  // Nothing from the last song should keep sounding
+  currentEffect->handlePanic();
+  if (preset.effect != pedalState.effectIdx) {
+    switchEffect(preset.effect);
+  }
+
+  if (preset.midiChannel >= 1 && preset.midiChannel <= 16) {
+    pedalState.midiChannel = preset.midiChannel;
+    settings.setMidiChannel(pedalState.midiChannel);
+  }
+  pedalState.isActive = preset.isActive == 1;
+  currentEffect->loadPreset(preset, &pedalState);
+}
 
 /* EVENT HANDLERS */
 void handleActiveSense() {
@@ -29,6 +130,144 @@ void handleActiveSense() {
   usbMIDI.sendActiveSensing();
 }
 
+// Clock and transport come in from both DIN and USB, but only the source
+// the arbiter is following gets forwarded and drives the timebase
+void notifyTransport(TransportEvent_t event) {
+  if (currentEffect) currentEffect->handleTransport(event);
+}
+
+void handleClock(ClockSource_t source) {
+  Tick_t now = nowTicks(); // When the pulse was read, there's no telling how long it waited in the input
+  if (!clockArbiter.acceptClock(source, now)) return;
+
+  clockStats.pulseIn(now);
+
+  // The clock divider sends its own clock when it's on
+  if (!currentEffect || currentEffect->isClockThru()) {
+    sendMidiClock();
+    clockStats.pulseOut(now, nowTicks());
+  }
+  timebase.clockPulse(now);
+
+  // Effects line up with the first pulse after Start before it's handled,
+  // so their first step plays on it
+  if (transport.pulse(tempoTracker.getMissed())) notifyTransport(TRANSPORT_EVENT_PLAY);
+  if (currentEffect) currentEffect->handleClock();
+}
+
+void handleStart(ClockSource_t source) {
+  if (!clockArbiter.acceptTransport(source)) return;
+  sendMidiStart();
+  transport.start(nowTicks());
+}
+
+void handleStop(ClockSource_t source) {
+  if (!clockArbiter.acceptTransport(source)) return;
+  sendMidiStop();
+  if (transport.stop()) notifyTransport(TRANSPORT_EVENT_STOP);
+}
+
+void handleContinue(ClockSource_t source) {
+  if (!clockArbiter.acceptTransport(source)) return;
+  sendMidiContinue();
+  transport.resume(nowTicks());
+}
+
+void handleSongPosition(ClockSource_t source, unsigned beats) {
+  if (!clockArbiter.acceptTransport(source)) return;
+  sendMidiSongPosition(beats);
+  transport.setSongPosition(beats);
+}
+
+// SysEx requests get their reply on the input they came in on
+void sendSysExTo(ClockSource_t source, unsigned length, const byte *data) {
+  if (source == CLOCK_SOURCE_DIN) hardwareMIDI.sendSysEx(length, data);
+  else usbMIDI.sendSysEx(length, data);
+}
+
+void sendPresetDump(ClockSource_t source, uint8_t slot) {
+  Preset_t preset;
+  if (!presets.load(slot, preset)) return;
+  byte reply[4 + (sizeof(Preset_t) * 8 + 6) / 7];
+  reply[0] = SYSEX_ID;
+  reply[1] = SYSEX_DEVICE;
+  reply[2] = SYSEX_PRESET_DUMP;
+  reply[3] = slot;
+  unsigned length = 4 + midi::encodeSysEx((byte*) &preset, reply + 4, sizeof(Preset_t));
+  sendSysExTo(source, length, reply);
+}
+
+void handleSysEx(ClockSource_t source, byte *data, unsigned size) {
+  // The array includes the F0 and F7
+  if (size < SYSEX_HEADER_SIZE + 1 || data[1] != SYSEX_ID || data[2] != SYSEX_DEVICE) return;
+
+  switch (data[3]) {
+  case SYSEX_CLOCK_STATS: {
+    byte reply[3 + (CLOCK_STATS_REPLY_SIZE * 8 + 6) / 7];
+    for (uint8_t i = 0; i < NUM_CLOCK_STATS; i++) {
+      sendSysExTo(source, clockStats.buildReply(i, reply), reply);
+    }
+    break;
+  }
+  case SYSEX_CLOCK_STATS_RESET:
+    clockStats.reset();
+    break;
+  case SYSEX_TASK_STATS: {
+    byte reply[3 + (TASK_REPLY_SIZE * 8 + 6) / 7];
+    for (uint8_t i = 0; i < taskScheduler.getNumTasks(); i++) {
+      sendSysExTo(source, taskScheduler.buildReply(i, reply), reply);
+    }
+    break;
+  }
+  case SYSEX_TASK_STATS_RESET:
+    taskScheduler.resetStats();
+    break;
+  case SYSEX_PRESET_STORE: {
+    if (size < SYSEX_HEADER_SIZE + 2) break;
+    Preset_t preset;
+    capturePreset(preset);
+    presets.store(data[4], preset);
+    break;
+  }
+  case SYSEX_PRESET_DUMP:
+    // Sent from the midi task once the EEPROM is free
+    if (size < SYSEX_HEADER_SIZE + 2 || !presets.isValid(data[4])) break;
+    pendingDump = data[4];
+    pendingDumpSource = source;
+    break;
+  case SYSEX_PRESET_WRITE: {
+    // Exactly one encoded preset between the slot and the F7
+    Preset_t preset;
+    if (size != SYSEX_HEADER_SIZE + 2 + (sizeof(Preset_t) * 8 + 6) / 7) break;
+    midi::decodeSysEx(data + 5, (byte*) &preset, size - 6);
+    if (preset.version == PRESET_VERSION) presets.store(data[4], preset);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Program changes on the pedal's channel recall a preset. They're still
+// passed on, so a synth on the same channel changes patch too
+void handleProgramChange(byte channel, byte number) {
+  if (channel == pedalState.midiChannel && number < NUM_PRESETS) {
+    pendingPreset = number;
+  }
+}
+
+void handleDinClock() { handleClock(CLOCK_SOURCE_DIN); }
+void handleUsbClock() { handleClock(CLOCK_SOURCE_USB); }
+void handleDinStart() { handleStart(CLOCK_SOURCE_DIN); }
+void handleUsbStart() { handleStart(CLOCK_SOURCE_USB); }
+void handleDinStop() { handleStop(CLOCK_SOURCE_DIN); }
+void handleUsbStop() { handleStop(CLOCK_SOURCE_USB); }
+void handleDinContinue() { handleContinue(CLOCK_SOURCE_DIN); }
+void handleUsbContinue() { handleContinue(CLOCK_SOURCE_USB); }
+void handleDinSongPosition(unsigned beats) { handleSongPosition(CLOCK_SOURCE_DIN, beats); }
+void handleUsbSongPosition(unsigned beats) { handleSongPosition(CLOCK_SOURCE_USB, beats); }
+void handleOwnSysEx(uint8_t input, byte *data, unsigned size) { handleSysEx((ClockSource_t) input, data, size); }
+
 typedef struct {
   uint8_t r;
   uint8_t g;
@@ -41,7 +280,8 @@ static const Rgb_t effectColours[NUM_EFFECTS] = {
   {255, 0, 170},
   {255, 0, 255},
   {0, 255, 255},
-  {255, 255, 0}
+  {255, 255, 0},
+  {0, 0, 255}
 };
 
 static const Rgb_t midiColours[16] = {
@@ -69,10 +309,6 @@ void pulseMidiColour(uint8_t index) {
       dir = -dir;
 }
 
-void handleClock() {
-  if (currentEffect) currentEffect->handleClock();
-}
-
 void indicateModeChange(uint16_t flashTimeMs) {
   setLed(255, 0, 0);
   delay(flashTimeMs);
@@ -87,6 +323,12 @@ void indicateModeChange(uint16_t flashTimeMs) {
   setLed(0, 0, 0);
 }
 
+void indicateClockOut(bool isOn) {
+  if (isOn) setLed(255, 255, 255); // White
+  else setLed(0, 0, 0); // Off
+  delay(300);
+}
+
 void indicateBoot() {
   uint8_t r = 255, g = 0, b = 0;
   uint8_t phase = 0;
@@ -119,6 +361,71 @@ void indicateBoot() {
   setLed(0, 0, 0);
 }
 
+/* TASKS */
+// Midi in and out, and the timebase the effects' due notes come from
+void runMidiTask() {
+  timebase.refresh(nowTicks());
+  masterClock.sendPending();
+  sysExThru.sendDeferred();
+
+  if (currentEffect) {
+    currentEffect->process(&pedalState);
+  }
+
+  // Presets are only read once a settings or preset byte write has finished,
+  // rather than stalling the midi until it has
+  if (!presets.canLoad()) return;
+
+  // The effect can be swapped out now it's not in the middle of anything
+  if (pendingPreset != PRESET_IDLE) {
+    recallPreset(pendingPreset);
+    pendingPreset = PRESET_IDLE;
+  }
+  if (pendingDump != PRESET_IDLE && !sysExThru.isStreaming()) {
+    sendPresetDump(pendingDumpSource, pendingDump);
+    pendingDump = PRESET_IDLE;
+  }
+}
+
+// The switches are sampled at the debounce rate, so their events only
+// change here
+void runControlTask() {
+  inputScanner.sample();
+  pedalState.stompEvent = stompSwitch.getEvent();
+  pedalState.extEvent = extSwitch.getEvent();
+  pedalState.rotaryMoved = rotarySwitch.refresh();
+  pedalState.rotaryPos = rotarySwitch.getPosition();
+
+  // Midi panic
+  if (pedalState.stompEvent == ResetPress || pedalState.extEvent == ResetPress) {
+    indicateModeChange(100);
+
+    if (currentEffect) {
+      currentEffect->handlePanic();
+    }
+  }
+
+  if (currentEffect) {
+    currentEffect->handleControls(&pedalState);
+  }
+}
+
+void runLedTask() {
+  if (currentEffect) {
+    currentEffect->updateLed(&pedalState);
+  }
+}
+
+// Saving and the clock, transport and SysEx timeouts only need a look every few ms
+void runHousekeepingTask() {
+  settings.refresh();
+  presets.refresh();
+  sysExThru.refresh();
+  clockStats.refresh();
+  clockArbiter.refresh(nowTicks());
+  if (transport.refresh(nowTicks())) notifyTransport(TRANSPORT_EVENT_FREE);
+}
+
 void setup() {
   /* SWITCHES */
   stompSwitch.setup();
@@ -136,21 +443,30 @@ void setup() {
   hardwareMIDI.begin(MIDI_CHANNEL_OMNI);
   usbMIDI.begin(MIDI_CHANNEL_OMNI);
 
-  // Set event handler
-  hardwareMIDI.setHandleActiveSensing(handleActiveSense);
-
   // Turn thru off to control midi flow
   hardwareMIDI.turnThruOff();
   
-  bool hasBeenInMidiSetup = false;
+  /* SETTINGS */
+  settings.begin();
+  presets.begin();
+
+  /* MASTER CLOCK */
+  masterClock.setOutput(settings.getClockOut());
+  masterClock.begin();
+
   // Fetch midi channel
-  pedalState.midiChannel = EEPROM.read(EEPROM_MIDI_CHANNEL); // default to channel in eeprom
-  if (pedalState.midiChannel > 16) {
+  pedalState.midiChannel = settings.getMidiChannel();
+  if (pedalState.midiChannel < 1 || pedalState.midiChannel > 16) {
     pedalState.midiChannel = 1;
   }
 
+  // Fetch the effect, setup mode can change it
+  uint8_t effect = settings.getEffect();
+  if (effect < NUM_EFFECTS) pedalState.effectIdx = effect;
+  else pedalState.effectIdx = E_MIDIMUTE;
+
   /* SETUP MODE */
-  // Enter if stomp held, otherwise fetch effect from EEPROM
+  // Enter if stomp held
   if (!stompSwitch.getValue()) {
 
     // Setup mode led indicator
@@ -163,6 +479,7 @@ void setup() {
     while (inSetup) {
 
       // Check if we need to exit setup mode
+      inputScanner.refresh();
       pedalState.stompEvent = stompSwitch.getEvent();
       switch(pedalState.stompEvent) {
         case Click: // Exit setup mode
@@ -171,91 +488,76 @@ void setup() {
           break;
         case LongPress: // Enter MIDI channel setup
           inMidiSetup = !inMidiSetup;
-          hasBeenInMidiSetup = true;
           break;
         default:
           break;
       }
 
+      // Toggle sending midi clock when there's no clock in
+      if (extSwitch.getEvent() == Click) {
+        masterClock.setOutput(!masterClock.getOutput());
+        settings.setClockOut(masterClock.getOutput());
+        indicateClockOut(masterClock.getOutput());
+      }
+
       // Update and get position
       rotarySwitch.refresh();
       uint8_t pos = rotarySwitch.getPosition();
 
       if (inMidiSetup) {
         pedalState.midiChannel = pos + 1;
+        settings.setMidiChannel(pedalState.midiChannel);
         pulseMidiColour(pos);
       } else {
         if (pos < NUM_EFFECTS) {
           setLed(effectColours[pos].r, effectColours[pos].g, effectColours[pos].b);
           pedalState.effectIdx = pos;
-          EEPROM.write(EEPROM_EFFECT, pos);
+          settings.setEffect(pos);
         } else {
           setLed(0, 0, 0);
         }
       }
       
     }
-  } else {
-    uint8_t effect = EEPROM.read(EEPROM_EFFECT);
-    if (effect < NUM_EFFECTS) pedalState.effectIdx = effect;
-    else pedalState.effectIdx = E_MIDIMUTE;
-    
-    if (hasBeenInMidiSetup) EEPROM.write(EEPROM_MIDI_CHANNEL, pedalState.midiChannel);
+
+    // The settings only changed in RAM while the rotary was being turned,
+    // save them once now nothing else is running
+    settings.flush();
   }
 
   // On boot, the pedal isn't active
   pedalState.isActive = false;
 
-  // This probably isn't the best way to do this, but it
-  // means that only one effect is instantiated at any one time
-  switch (pedalState.effectIdx) {
-  case 0:
-    currentEffect = new MidiMuteEffect();
-    break;
-  case 1:
-    currentEffect = new ChordGenEffect(1);
-    break;
-  case 2:
-    currentEffect = new ChordGenEffect(2);
-    break;
-  case 3:
-    currentEffect = new ChordGenEffect(3);
-    break;
-  case 4:
-    currentEffect = new DelayEffect();
-    break;
-  case 5:
-    currentEffect = new ArpEffect();
-    break;
-  default:
-    currentEffect = new MidiMuteEffect(); // Default to MidiMute if out of range
-    break;
-  }
+  currentEffect = createEffect(pedalState.effectIdx);
 
-  // Set the clock event handler since this is unique to each effect
-  hardwareMIDI.setHandleClock(handleClock);
+  // Set the clock and transport handlers for both inputs, now there's an
+  // effect to pass the clock on to
+  hardwareMIDI.setHandleClock(handleDinClock);
+  hardwareMIDI.setHandleStart(handleDinStart);
+  hardwareMIDI.setHandleStop(handleDinStop);
+  hardwareMIDI.setHandleContinue(handleDinContinue);
+  hardwareMIDI.setHandleSongPosition(handleDinSongPosition);
+  hardwareMIDI.setHandleActiveSensing(handleActiveSense);
+  hardwareMIDI.setHandleProgramChange(handleProgramChange);
+  usbMIDI.setHandleClock(handleUsbClock);
+  usbMIDI.setHandleStart(handleUsbStart);
+  usbMIDI.setHandleStop(handleUsbStop);
+  usbMIDI.setHandleContinue(handleUsbContinue);
+  usbMIDI.setHandleSongPosition(handleUsbSongPosition);
+  usbMIDI.setHandleActiveSensing(handleActiveSense);
+  sysExThru.setHandleOwn(handleOwnSysEx);
+  usbMIDI.setHandleProgramChange(handleProgramChange);
+
+  // The fixed rate tasks are checked in this order
+  taskScheduler.add(runMidiTask, 0);
+  taskScheduler.add(runControlTask, INPUT_SAMPLE_MS * TICKS_PER_MS);
+  taskScheduler.add(runHousekeepingTask, HOUSEKEEPING_TASK_MS * TICKS_PER_MS);
+  taskScheduler.add(runLedTask, LED_TASK_MS * TICKS_PER_MS);
 
   // Indicate boot led sequence
   indicateBoot();
 }
 
 void loop() {
-  pedalState.stompEvent = stompSwitch.getEvent();
-  pedalState.extEvent = extSwitch.getEvent();
-  pedalState.rotaryMoved = rotarySwitch.refresh();
-  pedalState.rotaryPos = rotarySwitch.getPosition();
-
-  // Midi panic
-  if (pedalState.stompEvent == ResetPress || pedalState.extEvent == ResetPress) {
-    indicateModeChange(100);
-
-    if (currentEffect) {
-      currentEffect->handlePanic();
-    }
-  }
-
-  // Process midi
-  if (currentEffect) {
-    currentEffect->process(&pedalState);
-  }
+  taskScheduler.run();
 }
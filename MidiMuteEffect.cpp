@@ -1,70 +1,44 @@
 #include "midi_Defs.h"
 #include "Arduino.h"
-#include "EEPROM.h"
+#include "Settings.h"
 #include "Utils.h"
+#include "NoteTracker.h"
 #include "MidiMuteEffect.h"
 
 // Constructor
-ChannelMute::ChannelMute(uint8_t midiChannel, uint8_t eepromAddress) {
+ChannelMute::ChannelMute(uint8_t midiChannel) {
   channel = midiChannel;
-  address = eepromAddress;
-  stopSent = 0;
 }
 
 // Getters
 uint8_t ChannelMute::getChannel() { return channel; }
-uint8_t ChannelMute::getAddress() { return address; }
 bool ChannelMute::getIsMuted() { return isMuted; }
-uint8_t ChannelMute::getMidiType() { return midiType; }
-uint8_t ChannelMute::getMidiData1() { return midiData1; }
-uint8_t ChannelMute::getMidiData2() { return midiData2; }
-uint8_t ChannelMute::getMidiChannel() { return midiChannel; }
-bool ChannelMute::getStopSent() { return stopSent; }
 
 // Setters
 void ChannelMute::setIsMuted(bool state) { isMuted = state; }
-void ChannelMute::setStopSent(bool state) { stopSent = state; }
 
 bool ChannelMute::toggleIsMuted() {
   isMuted = !isMuted;
   return isMuted;
 }
-
-void ChannelMute::storeMidi(uint8_t type, uint8_t data1, uint8_t data2,
-                            uint8_t channel) {
-  midiType = type;
-  midiData1 = data1;
-  midiData2 = data2;
-  midiChannel = channel;
-}
 /* END CHANNEL MUTE CLASS */
 
 MidiMuteEffect::MidiMuteEffect() {
   ledOn = false;
-  ledOnStartMs = 0;
+  ledOnStartTick = 0;
 
   // Populate the channelMutes array and get 
-  // the last mute state for each channelMute from EEPROM
+  // the last mute state for each channelMute from the settings
   for (uint8_t i = 0; i < MIDI_NUM_CHANNELS; i++) {
-    channelMutes[i] = ChannelMute(i+1, EEPROM_MUTE_BASE + i);
-    channelMutes[i].setIsMuted(EEPROM.read(EEPROM_MUTE_BASE + i));
+    channelMutes[i] = ChannelMute(i+1);
+    channelMutes[i].setIsMuted(settings.getMute(i+1));
   }
 }
 
 void MidiMuteEffect::sendAllNotesOff(ChannelMute &channel) {
-  if (!channel.getStopSent()) {
-    // Send all notes off
-    sendMidiBoth(midi::MidiType::ControlChange, midi::AllNotesOff, 0,
-                 channel.getChannel());
-
-    // Handles hardware that does not have all notes off CC by sending note off
-    // for the last recorded note
-    sendMidiBoth(midi::MidiType::NoteOff, channel.getMidiData1(),
-                 channel.getMidiData2(), channel.getChannel());
-
-    // Change channel state so we know a note off has been sent
-    channel.setStopSent(true);
-  }
+  // Note offs for exactly the notes still sounding on the channel, which
+  // also works on hardware that doesn't have the all notes off CC
+  noteTracker.releaseChannel(channel.getChannel());
 }
 
 void MidiMuteEffect::handleMidiMessage(
@@ -79,24 +53,17 @@ void MidiMuteEffect::handleMidiMessage(
     break;
   case midi::MidiType::ActiveSensing: // Has seperate handler
     break;
-  case midi::MidiType::Continue: // Send continue
-    sendMidiContinue();
+  case midi::MidiType::Continue: // Has seperate handler
     break;
-  case midi::MidiType::Start: // Send start
-    sendMidiStart();
+  case midi::MidiType::Start: // Has seperate handler
     break;
-  case midi::MidiType::Stop: // Send stop
-    sendMidiStop();
+  case midi::MidiType::Stop: // Has seperate handler
     break;
   default: 
     // If pedal isn't active, or the channel isn't muted, send the midi
     if (!isActive || !channelMutes[channel - 1].getIsMuted()) {
       // Pass through midi data
       sendMidiBoth(type, data1, data2, channel);
-
-      // Store MIDI message in channel mute
-      channelMutes[channel - 1].storeMidi(type, data1, data2, channel);
-      channelMutes[channel - 1].setStopSent(false);
     }
     break;
   }
@@ -124,10 +91,10 @@ void MidiMuteEffect::handleSwitchEvent(State_t *state, SwEvent_t event) {
       setLed(0, 255, 0); // Green
     }
     ledOn = true;
-    ledOnStartMs = millis();
+    ledOnStartTick = nowTicks();
 
     // Save new mute state
-    EEPROM.write(chan.getAddress(), chan.getIsMuted());
+    settings.setMute(chan.getChannel(), chan.getIsMuted());
     break;
   } default:
     break;
@@ -135,23 +102,27 @@ void MidiMuteEffect::handleSwitchEvent(State_t *state, SwEvent_t event) {
 }
 
 void MidiMuteEffect::handlePanic() {
-  for (uint8_t i = 0; i < 16; i++) { // 16 midi channels total
-    sendMidiBoth(midi::MidiType::ControlChange, midi::AllNotesOff, 0, i+1);
-  }
+  noteTracker.releaseAll();
 }
 
 void MidiMuteEffect::handleClock() {
-  hardwareMIDI.sendClock();
-  usbMIDI.sendClock();
+  // Clock is forwarded before this is called, nothing else to do
 }
 
-void MidiMuteEffect::process(State_t *state) {
+void MidiMuteEffect::updateLed(State_t *state) {
+  if (ledOn && (nowTicks() - ledOnStartTick > LED_TIME_MS * TICKS_PER_MS)) {
+    setLed(0, 0, 0);
+    ledOn = false;
+  }
+
   if (state->isActive && !ledOn) {
     setLed(255, 0, 0); // Red  
   } else if (!state->isActive && !ledOn) {
     setLed(0, 0, 0); // Off
   }
+}
 
+void MidiMuteEffect::handleControls(State_t *state) {
   // If the rotary has changed position, update the position and show
   // the user the current position's channel mute status
   if (state->rotaryMoved) {
@@ -161,25 +132,37 @@ void MidiMuteEffect::process(State_t *state) {
       setLed(0, 255, 0); // Green
     }
     ledOn = true;
-    ledOnStartMs = millis();
+    ledOnStartTick = nowTicks();
   }
 
   // We pass the state object so we can modify the isActive state
   handleSwitchEvent(state, state->stompEvent);
   handleSwitchEvent(state, state->extEvent);
+}
 
-  if (ledOn && (millis() - ledOnStartMs > LED_TIME_MS)) {
-    setLed(0, 0, 0);
-    ledOn = false;
-  }
-
-  if (usbMIDI.read()) {
+void MidiMuteEffect::process(State_t *state) {
+  if (usbMIDI.read() && !isRoutedMessage(usbMIDI.getType())) {
     handleMidiMessage(state->isActive, usbMIDI.getType(), usbMIDI.getData1(),
                       usbMIDI.getData2(), usbMIDI.getChannel());
   }
 
-  if (hardwareMIDI.read()) {
+  if (hardwareMIDI.read() && !isRoutedMessage(hardwareMIDI.getType())) {
     handleMidiMessage(state->isActive, hardwareMIDI.getType(), hardwareMIDI.getData1(),
                       hardwareMIDI.getData2(), hardwareMIDI.getChannel());
   }
-}
\ No newline at end of file
+}
+
+void MidiMuteEffect::savePreset(Preset_t &preset) {
+  preset.mutes = 0;
+  for (uint8_t i = 0; i < MIDI_NUM_CHANNELS; i++) {
+    if (channelMutes[i].getIsMuted()) preset.mutes |= 1U << i;
+  }
+}
+
+void MidiMuteEffect::loadPreset(const Preset_t &preset, State_t *state) {
+  for (uint8_t i = 0; i < MIDI_NUM_CHANNELS; i++) {
+    bool isMuted = preset.mutes & (1U << i);
+    channelMutes[i].setIsMuted(isMuted);
+    settings.setMute(i+1, isMuted);
+  }
+}
@@ -4,6 +4,7 @@
 #include "Globals.h"
 #include "Switches.h"
 #include "BaseEffect.h"
+#include "Timebase.h"
 #include <stdint.h>
 
 enum MIDI_Channel {
@@ -30,40 +31,26 @@ enum MIDI_Channel {
 class ChannelMute {
 private:
   uint8_t channel;
-  uint8_t address; // EEPROM save address
   bool isMuted; // Mute state
-  uint8_t midiType;
-  uint8_t midiData1;
-  uint8_t midiData2;
-  uint8_t midiChannel; // Midi channel
-  bool stopSent;
 
 public:
   // Default constructor for usage with arrays. 
   // NOTE: These defaults gets overwritten later in the MidiMuteEffect constructor
-  ChannelMute() : channel(0), address(0), isMuted(false) {}
+  ChannelMute() : channel(0), isMuted(false) {}
 
-  ChannelMute(uint8_t midiChannel, uint8_t eepromAddress);
+  ChannelMute(uint8_t midiChannel);
   uint8_t getChannel();
-  uint8_t getAddress();
   bool getIsMuted();
-  uint8_t getMidiType();
-  uint8_t getMidiData1();
-  uint8_t getMidiData2();
-  uint8_t getMidiChannel();
-  bool getStopSent();
 
   void setIsMuted(bool state);
   bool toggleIsMuted();
-  void setStopSent(bool state);
-  void storeMidi(uint8_t type, uint8_t data1, uint8_t data2, uint8_t channel);
 };
 
 class MidiMuteEffect : public BaseEffect {
 private:
   ChannelMute channelMutes[MIDI_NUM_CHANNELS];
   bool ledOn;
-  unsigned long ledOnStartMs;
+  Tick_t ledOnStartTick;
   
   void sendAllNotesOff(ChannelMute &channel);
   void handleMidiMessage(bool isActive, midi::MidiType type, midi::DataByte data1,
@@ -72,8 +59,12 @@ private:
 public:
   MidiMuteEffect();
   void process(State_t *state) override;
+  void handleControls(State_t *state) override;
+  void updateLed(State_t *state) override;
   void handlePanic() override;
   void handleClock() override;
+  void savePreset(Preset_t &preset) override;
+  void loadPreset(const Preset_t &preset, State_t *state) override;
 };
 
 #endif // MIDIMUTE_H
@@ -0,0 +1,80 @@
+#include "Arduino.h"
+#include "MidiSerial.h"
+#include <util/atomic.h>
+
+/* BEGIN MIDI SERIAL CLASS */
+MidiSerial::MidiSerial() {
+  clockQueued = 0;
+  clockSent = 0;
+}
+
+void MidiSerial::begin(unsigned long baud) {
+  // Double speed, as HardwareSerial sets it up, 8N1
+  uint16_t setting = (F_CPU / 4 / baud - 1) / 2;
+  UCSR1A = _BV(U2X1);
+  UBRR1H = setting >> 8;
+  UBRR1L = setting & 0xFF;
+  UCSR1C = _BV(UCSZ11) | _BV(UCSZ10);
+  UCSR1B = _BV(RXEN1) | _BV(TXEN1) | _BV(RXCIE1);
+}
+
+unsigned MidiSerial::available() { return rxRing.getCount(); }
+
+uint8_t MidiSerial::read() {
+  uint8_t b = 0;
+  rxRing.pop(b);
+  return b;
+}
+
+size_t MidiSerial::write(uint8_t b) {
+  while (!txRing.push(b)) {
+    // With interrupts off the queue never empties, so send by hand
+    if (bit_is_clear(SREG, SREG_I) && bit_is_set(UCSR1A, UDRE1)) handleDataEmpty();
+  }
+  enableSend();
+  return 1;
+}
+
+unsigned MidiSerial::availableForWrite() {
+  return MIDI_SERIAL_TX_SIZE - txRing.getCount();
+}
+
+void MidiSerial::enableSend() {
+  // The interrupt turns itself off when there's nothing left
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    UCSR1B |= _BV(UDRIE1);
+  }
+}
+
+void MidiSerial::sendClock() {
+  if ((uint8_t)(clockQueued - clockSent) < 0xFF) clockQueued++;
+  UCSR1B |= _BV(UDRIE1);
+}
+
+void MidiSerial::handleReceive() {
+  bool isParityError = bit_is_set(UCSR1A, UPE1);
+  uint8_t b = UDR1;
+  if (!isParityError) rxRing.push(b); // Dropped if the main loop is that far behind
+}
+
+void MidiSerial::handleDataEmpty() {
+  uint8_t b;
+  if (clockSent != clockQueued) {
+    UDR1 = MIDI_CLOCK_BYTE;
+    clockSent++;
+  } else if (txRing.pop(b)) {
+    UDR1 = b;
+  } else {
+    UCSR1B &= ~_BV(UDRIE1);
+  }
+}
+
+/* END MIDI SERIAL CLASS */
+
+ISR(USART1_RX_vect) {
+  midiSerial.handleReceive();
+}
+
+ISR(USART1_UDRE_vect) {
+  midiSerial.handleDataEmpty();
+}
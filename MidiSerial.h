@@ -0,0 +1,47 @@
+#ifndef MIDI_SERIAL_H
+#define MIDI_SERIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "SpscRing.h"
+
+#define MIDI_SERIAL_RX_SIZE 64 // Bytes waiting for the main loop to read (a power of 2)
+#define MIDI_SERIAL_TX_SIZE 64 // Bytes waiting to go out (a power of 2)
+#define MIDI_CLOCK_BYTE 0xF8
+
+/* MIDI SERIAL CLASS */
+// The DIN port's serial driver, used in place of Serial1 so the clock
+// interrupts can send their pulses themselves. Serial1's write isn't safe to
+// call from an interrupt, and writing its data register behind its back can
+// make it drop one of its own bytes, so this owns USART1 instead: the main
+// loop only ever queues bytes, and only the data register empty interrupt
+// writes them out. Clock pulses from the interrupts skip the queue and go out
+// next, which midi allows for real-time bytes, so a pulse goes out at most two
+// bytes (640us) after its interrupt, however long the main loop takes.
+// Nothing else can use Serial1, or its interrupts clash with these.
+class MidiSerial {
+private:
+  SpscRing<uint8_t, MIDI_SERIAL_RX_SIZE> rxRing; // Filled by the receive interrupt
+  SpscRing<uint8_t, MIDI_SERIAL_TX_SIZE> txRing; // Filled by the main loop
+  volatile uint8_t clockQueued; // Pulses from the clock interrupts, wraps
+  volatile uint8_t clockSent; // How many of those have gone out, interrupts only
+
+  void enableSend();
+
+public:
+  MidiSerial();
+  void begin(unsigned long baud);
+  unsigned available();
+  uint8_t read();
+  size_t write(uint8_t b); // Waits for room when the queue is full
+  unsigned availableForWrite();
+
+  void sendClock(); // From a clock interrupt, goes out ahead of the queue
+  void handleReceive(); // Called from the receive interrupt
+  void handleDataEmpty(); // Called from the data register empty interrupt
+};
+/* END MIDI SERIAL CLASS */
+
+extern MidiSerial midiSerial;
+
+#endif // MIDI_SERIAL_H
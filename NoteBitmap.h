@@ -0,0 +1,61 @@
+#ifndef NOTE_BITMAP_H
+#define NOTE_BITMAP_H
+
+#include <stdint.h>
+
+#define NOTE_BITMAP_WORDS 4 // 4 * 32 bits = 128 midi notes
+
+// One bit per midi note. Finding the next/previous set note uses count
+// leading/trailing zeros, so it skips 32 empty notes at a time.
+class NoteBitmap {
+private:
+  uint32_t words[NOTE_BITMAP_WORDS];
+
+  static uint8_t lowestBit(uint32_t bits) { return __builtin_ctzl(bits); }
+  static uint8_t highestBit(uint32_t bits) {
+    return (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(bits);
+  }
+
+public:
+  NoteBitmap() { clear(); }
+
+  void clear() {
+    for (uint8_t i = 0; i < NOTE_BITMAP_WORDS; i++) {
+      words[i] = 0;
+    }
+  }
+
+  void set(uint8_t note) { words[(note >> 5) & 3] |= 1UL << (note & 31); }
+  void reset(uint8_t note) { words[(note >> 5) & 3] &= ~(1UL << (note & 31)); }
+  bool test(uint8_t note) const { return note < 128 && (words[note >> 5] >> (note & 31)) & 1; }
+
+  bool isEmpty() const {
+    return (words[0] | words[1] | words[2] | words[3]) == 0;
+  }
+
+  // The lowest set note >= from, or -1 if there isn't one
+  int16_t next(uint8_t from) const {
+    if (from > 127) return -1;
+    uint8_t w = from >> 5;
+    uint32_t bits = words[w] & (0xFFFFFFFFUL << (from & 31));
+    while (true) {
+      if (bits) return (w << 5) + lowestBit(bits);
+      if (++w >= NOTE_BITMAP_WORDS) return -1;
+      bits = words[w];
+    }
+  }
+
+  // The highest set note <= from, or -1 if there isn't one
+  int16_t prev(uint8_t from) const {
+    if (from > 127) from = 127;
+    int8_t w = from >> 5;
+    uint32_t bits = words[w] & (0xFFFFFFFFUL >> (31 - (from & 31)));
+    while (true) {
+      if (bits) return (w << 5) + highestBit(bits);
+      if (--w < 0) return -1;
+      bits = words[w];
+    }
+  }
+};
+
+#endif // NOTE_BITMAP_H
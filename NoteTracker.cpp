@@ -0,0 +1,73 @@
+#include "NoteTracker.h"
+#include "Utils.h"
+
+NoteTracker::NoteTracker() {
+  channelMask = 0;
+}
+
+void NoteTracker::track(midi::MidiType type, uint8_t data1, uint8_t data2,
+                        uint8_t channel) {
+  if (channel < 1 || channel > NUM_MIDI_CHANNELS) {
+    return;
+  }
+  uint8_t idx = channel - 1;
+
+  switch (type) {
+  case midi::MidiType::NoteOn:
+    if (data2 > 0) {
+      sounding[idx].set(data1);
+      channelMask |= 1U << idx;
+      break;
+    }
+    // Note on with 0 velocity is a note off
+    // fall through
+  case midi::MidiType::NoteOff:
+    sounding[idx].reset(data1);
+    if (sounding[idx].isEmpty()) {
+      channelMask &= ~(1U << idx);
+    }
+    break;
+  case midi::MidiType::ControlChange:
+    if (data1 == midi::AllNotesOff || data1 == midi::AllSoundOff) {
+      sounding[idx].clear();
+      channelMask &= ~(1U << idx);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+bool NoteTracker::isSounding(uint8_t channel, uint8_t note) {
+  if (channel < 1 || channel > NUM_MIDI_CHANNELS) {
+    return false;
+  }
+  return sounding[channel - 1].test(note);
+}
+
+void NoteTracker::releaseNote(uint8_t channel, uint8_t note) {
+  if (isSounding(channel, note)) {
+    sendMidiBoth(midi::MidiType::NoteOff, note, 0, channel);
+  }
+}
+
+void NoteTracker::releaseChannel(uint8_t channel) {
+  if (channel < 1 || channel > NUM_MIDI_CHANNELS) {
+    return;
+  }
+  NoteBitmap &notes = sounding[channel - 1];
+
+  // Each note off is tracked as it's sent, so one dropped during a SysEx dump
+  // stays sounding for next time
+  for (int16_t note = notes.next(0); note != -1; note = notes.next(note + 1)) {
+    sendMidiBoth(midi::MidiType::NoteOff, note, 0, channel);
+  }
+}
+
+void NoteTracker::releaseAll() {
+  for (uint8_t i = 0; i < NUM_MIDI_CHANNELS; i++) {
+    if (channelMask & (1U << i)) {
+      releaseChannel(i + 1);
+    }
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef NOTE_TRACKER_H
+#define NOTE_TRACKER_H
+
+#include "Globals.h"
+#include "NoteBitmap.h"
+
+#define NUM_MIDI_CHANNELS 16
+
+/* NOTE TRACKER CLASS */
+// Keeps track of every note that's currently sounding on the outputs. All midi
+// output goes through sendMidiBoth, which updates the tracker, so panic,
+// bypass and chord changes can send note offs for exactly the notes that need
+// them instead of blanket All Notes Off messages.
+class NoteTracker {
+private:
+  NoteBitmap sounding[NUM_MIDI_CHANNELS]; // The sounding notes on each channel
+  uint16_t channelMask; // Bit per channel that has any sounding notes
+
+public:
+  NoteTracker();
+  void track(midi::MidiType type, uint8_t data1, uint8_t data2, uint8_t channel); // Update from a sent message
+  bool isSounding(uint8_t channel, uint8_t note);
+  void releaseNote(uint8_t channel, uint8_t note); // Send a note off, only if the note is sounding
+  void releaseChannel(uint8_t channel); // Send note offs for every sounding note on a channel
+  void releaseAll(); // Send note offs for every sounding note
+};
+/* END NOTE TRACKER CLASS */
+
+extern NoteTracker noteTracker;
+
+#endif // NOTE_TRACKER_H
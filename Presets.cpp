@@ -0,0 +1,80 @@
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Utils.h"
+#include "Presets.h"
+#include <stddef.h>
+
+static_assert(sizeof(Preset_t) <= PRESET_SLOT_SIZE, "Preset doesn't fit in a slot");
+static_assert(PRESET_BASE + NUM_PRESETS * PRESET_SLOT_SIZE <= 0x400, "Presets don't fit in the EEPROM");
+
+/* BEGIN PRESETS CLASS */
+Presets::Presets() {
+  validSlots = 0;
+  writeSlot = 0;
+  writeIdx = PRESET_IDLE;
+}
+
+uint16_t Presets::slotAddress(uint8_t slot) {
+  return PRESET_BASE + slot * PRESET_SLOT_SIZE;
+}
+
+bool Presets::readSlot(uint8_t slot, Preset_t &out) {
+  uint8_t *bytes = (uint8_t*) &out;
+  uint16_t address = slotAddress(slot);
+  for (uint8_t i = 0; i < sizeof(Preset_t); i++) {
+    bytes[i] = EEPROM.read(address + i);
+  }
+  return out.version == PRESET_VERSION &&
+         out.crc == crc8(bytes, offsetof(Preset_t, crc));
+}
+
+void Presets::begin() {
+  Preset_t preset;
+  validSlots = 0;
+  for (uint8_t i = 0; i < NUM_PRESETS; i++) {
+    if (readSlot(i, preset)) validSlots |= 1U << i;
+  }
+}
+
+bool Presets::isValid(uint8_t slot) {
+  return slot < NUM_PRESETS && (validSlots & (1U << slot));
+}
+
+bool Presets::canLoad() { return eeprom_is_ready(); }
+
+bool Presets::load(uint8_t slot, Preset_t &out) {
+  if (!isValid(slot)) return false;
+  return readSlot(slot, out);
+}
+
+bool Presets::store(uint8_t slot, const Preset_t &preset) {
+  if (slot >= NUM_PRESETS || writeIdx != PRESET_IDLE) return false;
+
+  record = preset;
+  record.version = PRESET_VERSION;
+  record.crc = crc8((uint8_t*) &record, offsetof(Preset_t, crc));
+  writeSlot = slot;
+  writeIdx = 0;
+
+  // Half written, it can't be recalled until it's all there
+  validSlots &= ~(1U << slot);
+  return true;
+}
+
+void Presets::refresh() {
+  if (writeIdx == PRESET_IDLE || !eeprom_is_ready()) return;
+
+  const uint8_t *bytes = (const uint8_t*) &record;
+  uint16_t address = slotAddress(writeSlot);
+  while (writeIdx < sizeof(Preset_t)) {
+    uint8_t idx = writeIdx++;
+    if (EEPROM.read(address + idx) != bytes[idx]) {
+      EEPROM.write(address + idx, bytes[idx]);
+      return;
+    }
+  }
+
+  validSlots |= 1U << writeSlot;
+  writeIdx = PRESET_IDLE;
+}
+/* END PRESETS CLASS */
@@ -0,0 +1,74 @@
+#ifndef PRESETS_H
+#define PRESETS_H
+
+#include "Globals.h"
+
+#define NUM_PRESETS 16 // Recalled with program changes 0-15 on the pedal's channel
+#define PRESET_BASE 0x200 // After the settings ring
+#define PRESET_SLOT_SIZE 32
+#define PRESET_VERSION 1 // Change when Preset_t changes, older presets are ignored
+#define PRESET_STEP_BYTES 8 // Two arp steps a byte
+#define PRESET_IDLE 0xFF
+
+/* PRESET FORMAT */
+// Everything about the pedal's setup for a song. Each effect only fills in
+// (and reads back) the parts it uses.
+typedef struct {
+  uint8_t version; // PRESET_VERSION
+  uint8_t effect; // Effects enum
+  uint8_t midiChannel; // 1-16
+  uint8_t isActive; // Is the effect on?
+  uint8_t param; // The effect's main rotary value: chord, arp play mode or clock ratio
+  uint8_t division; // Delay division
+  uint8_t repeats; // Delay repeats
+  uint8_t decay; // Delay decay curve
+  uint8_t taps; // Delay tap pattern
+  uint8_t gate; // Arp gate
+  uint8_t swing; // Arp swing
+  uint8_t retrigger; // Arp retrigger all
+  uint16_t mutes; // MidiMute's muted channels, bit 0 is channel 1
+  uint8_t steps[PRESET_STEP_BYTES]; // Arp ratchets, step 0 in the low nibble of the first byte
+  uint8_t crc; // CRC-8 of everything before it
+} Preset_t;
+
+inline uint8_t getPresetStep(const Preset_t &preset, uint8_t idx) {
+  return (preset.steps[idx >> 1] >> ((idx & 1) * 4)) & 0x0F;
+}
+
+inline void setPresetStep(Preset_t &preset, uint8_t idx, uint8_t ratchets) {
+  uint8_t shift = (idx & 1) * 4;
+  preset.steps[idx >> 1] = (preset.steps[idx >> 1] & ~(0x0F << shift)) | ((ratchets & 0x0F) << shift);
+}
+
+/* PRESETS CLASS */
+// Stores presets in EEPROM, one per slot. Which slots hold a good preset is
+// worked out once at boot and kept in RAM, so recalling one is just reading
+// its slot, which is quick enough to do straight from the midi path. Reading
+// waits for any byte still being written (up to 3.3ms), so check canLoad()
+// first and leave it for later if it's busy.
+// Storing works like saving the settings, one byte at a time from refresh(),
+// only once the EEPROM has finished the last byte.
+class Presets {
+private:
+  uint16_t validSlots; // Bit per slot with a good preset in it
+  Preset_t record; // The preset being written
+  uint8_t writeSlot;
+  uint8_t writeIdx; // The next byte to write, PRESET_IDLE when not storing
+
+  static uint16_t slotAddress(uint8_t slot);
+  bool readSlot(uint8_t slot, Preset_t &out);
+
+public:
+  Presets();
+  void begin(); // Find the good presets
+  void refresh(); // Carry on storing, call regularly
+  bool canLoad(); // Loading now won't wait on an EEPROM write
+  bool load(uint8_t slot, Preset_t &out); // False if there's no good preset in the slot
+  bool store(uint8_t slot, const Preset_t &preset); // False if another preset is still being stored
+  bool isValid(uint8_t slot);
+};
+/* END PRESETS CLASS */
+
+extern Presets presets;
+
+#endif // PRESETS_H
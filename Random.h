@@ -0,0 +1,32 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+#define DEFAULT_RANDOM_SEED 0x2545F491UL
+
+// A small xorshift32 generator. It's a few shifts and xors per number (no
+// multiply or divide like Arduino's random()), and the same seed always gives
+// the same sequence, so a run can be reproduced.
+class Random {
+private:
+  uint32_t state; // Must never be 0
+
+public:
+  Random() { seed(DEFAULT_RANDOM_SEED); }
+
+  void seed(uint32_t value) { state = value ? value : DEFAULT_RANDOM_SEED; }
+
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // A number from 0 to n - 1. Scales the top 16 bits instead of using a
+  // modulo, the bias is negligible for the small ranges used here
+  uint8_t below(uint8_t n) { return ((next() >> 16) * n) >> 16; }
+};
+
+#endif // RANDOM_H
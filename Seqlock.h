@@ -0,0 +1,50 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+
+#define SEQLOCK_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// Publishes a value bigger than a byte (eg. a timestamp) from an interrupt to
+// the main loop without the main loop turning interrupts off. On the AVR a 32
+// bit read takes four loads, so an interrupt in the middle would tear it.
+// The writer makes the sequence odd while it writes and even again after, and
+// the reader copies the value until it gets a copy with the same even sequence
+// before and after. The interrupt can't be interrupted by the reader, so the
+// writer never waits, and the reader only retries when the interrupt hit
+// during its copy. The interrupt has to be the only writer, an interrupt
+// reading a value the main loop was halfway through writing would never finish.
+template <typename T>
+class Seqlock {
+private:
+  T value;
+  volatile uint8_t seq;
+
+public:
+  Seqlock() { seq = 0; }
+
+  void write(const T &newValue) {
+    seq = seq + 1;
+    SEQLOCK_BARRIER();
+    value = newValue;
+    SEQLOCK_BARRIER();
+    seq = seq + 1;
+  }
+
+  T read() {
+    T copy;
+    uint8_t before;
+    do {
+      before = seq;
+      SEQLOCK_BARRIER();
+      copy = value;
+      SEQLOCK_BARRIER();
+    } while ((before & 1) || before != seq);
+    return copy;
+  }
+
+  // For the writer, which always sees a whole value
+  const T &peek() { return value; }
+};
+
+#endif // SEQLOCK_H
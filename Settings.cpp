@@ -0,0 +1,180 @@
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Settings.h"
+#include "Utils.h"
+#include <stddef.h>
+#include <string.h>
+
+static_assert(sizeof(SettingsRecord_t) <= SETTINGS_SLOT_SIZE, "Settings record doesn't fit in a slot");
+
+/* BEGIN SETTINGS CLASS */
+Settings::Settings() {
+  memset(&values, 0xFF, sizeof(values));
+  serial = 0;
+  slot = SETTINGS_RING_SLOTS - 1; // So the first save goes in slot 0
+  isDirty = false;
+  dirtyMs = 0;
+  writeSlot = 0;
+  writeIdx = SETTINGS_IDLE;
+}
+
+uint16_t Settings::slotAddress(uint8_t idx) {
+  return SETTINGS_RING_BASE + idx * SETTINGS_SLOT_SIZE;
+}
+
+bool Settings::readSlot(uint8_t idx, SettingsRecord_t &out) {
+  uint8_t *bytes = (uint8_t*) &out;
+  uint16_t address = slotAddress(idx);
+  for (uint8_t i = 0; i < sizeof(SettingsRecord_t); i++) {
+    bytes[i] = EEPROM.read(address + i);
+  }
+  return out.crc == crc8(bytes, offsetof(SettingsRecord_t, crc));
+}
+
+void Settings::begin() {
+  // The newest good slot wins. There are only a few slots, so the serials
+  // are always close enough to compare across them wrapping
+  bool isFound = false;
+  SettingsRecord_t candidate;
+  for (uint8_t i = 0; i < SETTINGS_RING_SLOTS; i++) {
+    if (!readSlot(i, candidate)) continue;
+    if (!isFound || (int16_t)(candidate.serial - serial) > 0) {
+      values = candidate.values;
+      serial = candidate.serial;
+      slot = i;
+      isFound = true;
+    }
+  }
+
+  if (!isFound) {
+    importOldLayout();
+  }
+}
+
+void Settings::importOldLayout() {
+  // Before the ring, each setting had its own byte
+  values.effect = EEPROM.read(EEPROM_EFFECT);
+  values.midiChannel = EEPROM.read(EEPROM_MIDI_CHANNEL);
+  values.clockOut = EEPROM.read(EEPROM_CLOCK_OUT);
+  values.mutes = 0;
+  for (uint8_t i = 0; i < 16; i++) {
+    if (EEPROM.read(EEPROM_MUTE_BASE + i) == 1) values.mutes |= 1U << i;
+  }
+  for (uint8_t i = 0; i < SETTINGS_ARP_STEPS; i++) {
+    values.arpSteps[i] = EEPROM.read(EEPROM_ARP_BASE + i);
+  }
+  values.arpGate = EEPROM.read(EEPROM_ARP_BASE + EEPROM_ARP_GATE_OFFSET);
+  values.arpSwing = EEPROM.read(EEPROM_ARP_BASE + EEPROM_ARP_SWING_OFFSET);
+  values.arpRetrigger = EEPROM.read(EEPROM_ARP_BASE + EEPROM_ARP_RETRIGGER_OFFSET);
+  values.clockDivRatio = EEPROM.read(EEPROM_CLOCKDIV_RATIO);
+
+  // Saved to the ring once the pedal has been running for a bit
+  markDirty();
+}
+
+void Settings::markDirty() {
+  isDirty = true;
+  dirtyMs = millis();
+}
+
+void Settings::startSave() {
+  record.serial = serial + 1;
+  record.values = values;
+  record.crc = crc8((uint8_t*) &record, offsetof(SettingsRecord_t, crc));
+  writeSlot = (slot + 1) % SETTINGS_RING_SLOTS;
+  writeIdx = 0;
+  isDirty = false; // Changes from now on need another save
+}
+
+void Settings::writeNextByte() {
+  // Starting a write while the last one is still going would wait for it
+  if (!eeprom_is_ready()) return;
+
+  const uint8_t *bytes = (const uint8_t*) &record;
+  uint16_t address = slotAddress(writeSlot);
+  while (writeIdx < sizeof(SettingsRecord_t)) {
+    uint8_t idx = writeIdx++;
+    if (EEPROM.read(address + idx) != bytes[idx]) {
+      EEPROM.write(address + idx, bytes[idx]);
+      return;
+    }
+  }
+
+  // All written, it's the newest record now
+  serial = record.serial;
+  slot = writeSlot;
+  writeIdx = SETTINGS_IDLE;
+}
+
+void Settings::refresh() {
+  if (writeIdx == SETTINGS_IDLE) {
+    if (!isDirty || millis() - dirtyMs < SETTINGS_SAVE_DELAY_MS) return;
+    startSave();
+  }
+  writeNextByte();
+}
+
+void Settings::flush() {
+  // Finishes a save that's already going, then saves again if needed
+  while (isDirty || writeIdx != SETTINGS_IDLE) {
+    if (writeIdx == SETTINGS_IDLE) startSave();
+    writeNextByte();
+  }
+}
+
+bool Settings::isSaving() { return writeIdx != SETTINGS_IDLE; }
+
+void Settings::setEffect(uint8_t effect) {
+  if (values.effect == effect) return;
+  values.effect = effect;
+  markDirty();
+}
+
+void Settings::setMidiChannel(uint8_t channel) {
+  if (values.midiChannel == channel) return;
+  values.midiChannel = channel;
+  markDirty();
+}
+
+void Settings::setClockOut(bool state) {
+  if (getClockOut() == state) return;
+  values.clockOut = state;
+  markDirty();
+}
+
+void Settings::setMute(uint8_t channel, bool state) {
+  if (getMute(channel) == state) return;
+  values.mutes ^= 1U << (channel - 1);
+  markDirty();
+}
+
+void Settings::setArpStep(uint8_t idx, uint8_t ratchets) {
+  if (values.arpSteps[idx] == ratchets) return;
+  values.arpSteps[idx] = ratchets;
+  markDirty();
+}
+
+void Settings::setArpGate(uint8_t gate) {
+  if (values.arpGate == gate) return;
+  values.arpGate = gate;
+  markDirty();
+}
+
+void Settings::setArpSwing(uint8_t swing) {
+  if (values.arpSwing == swing) return;
+  values.arpSwing = swing;
+  markDirty();
+}
+
+void Settings::setArpRetrigger(bool state) {
+  if (getArpRetrigger() == state) return;
+  values.arpRetrigger = state;
+  markDirty();
+}
+
+void Settings::setClockDivRatio(uint8_t ratio) {
+  if (values.clockDivRatio == ratio) return;
+  values.clockDivRatio = ratio;
+  markDirty();
+}
+/* END SETTINGS CLASS */
@@ -0,0 +1,92 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "Globals.h"
+
+#define SETTINGS_RING_BASE 0x100 // Clear of the old single byte locations
+#define SETTINGS_SLOT_SIZE 32
+#define SETTINGS_RING_SLOTS 8 // Each save goes in the next slot, so each byte is written 1/8th as often
+#define SETTINGS_SAVE_DELAY_MS 2000 // Wait for the settings to stop changing before saving them
+#define SETTINGS_ARP_STEPS 16
+#define SETTINGS_IDLE 0xFF
+
+/* SAVED VALUES */
+// Everything the pedal remembers. Out of range values (eg. from an erased
+// EEPROM) are checked where they're used, like they were before.
+typedef struct {
+  uint8_t effect; // The effect picked in setup mode
+  uint8_t midiChannel; // 1-16
+  uint8_t clockOut; // Send midi clock when there is no clock in
+  uint16_t mutes; // MidiMute's muted channels, bit 0 is channel 1
+  uint8_t arpSteps[SETTINGS_ARP_STEPS]; // Ratchets per arp step, 0 is off
+  uint8_t arpGate;
+  uint8_t arpSwing;
+  uint8_t arpRetrigger;
+  uint8_t clockDivRatio;
+} SettingsValues_t;
+
+// One slot of the ring. A slot only counts if its CRC matches, so a save cut
+// short by the power going leaves the previous one in charge.
+typedef struct {
+  uint16_t serial; // Goes up by one every save, the highest is the newest
+  SettingsValues_t values;
+  uint8_t crc; // CRC-8 of everything before it
+} SettingsRecord_t;
+
+/* SETTINGS CLASS */
+// Keeps the settings in RAM, loaded from the newest good slot of a ring in
+// EEPROM at boot (or from the old one byte per setting locations, the first
+// time). Changes only mark the settings dirty. Once they've stopped changing
+// for a couple of seconds, refresh() writes them to the next slot one byte at
+// a time, and only when the EEPROM has finished the last byte, so saving never
+// waits on the EEPROM. Bytes that are already right aren't written again.
+class Settings {
+private:
+  SettingsValues_t values;
+  uint16_t serial; // The newest saved record's serial
+  uint8_t slot; // The slot it's in
+  bool isDirty;
+  uint32_t dirtyMs; // When the settings last changed
+
+  SettingsRecord_t record; // The record being written
+  uint8_t writeSlot;
+  uint8_t writeIdx; // The next byte of the record to write, SETTINGS_IDLE when not saving
+
+  uint16_t slotAddress(uint8_t idx);
+  bool readSlot(uint8_t idx, SettingsRecord_t &out);
+  void importOldLayout();
+  void startSave();
+  void writeNextByte();
+  void markDirty();
+
+public:
+  Settings();
+  void begin(); // Load the settings, call before anything reads them
+  void refresh(); // Carry on saving, call regularly
+  void flush(); // Save now and wait for it, only when nothing else is running (setup mode)
+  bool isSaving();
+
+  uint8_t getEffect() { return values.effect; }
+  void setEffect(uint8_t effect);
+  uint8_t getMidiChannel() { return values.midiChannel; }
+  void setMidiChannel(uint8_t channel);
+  bool getClockOut() { return values.clockOut == 1; }
+  void setClockOut(bool state);
+  bool getMute(uint8_t channel) { return values.mutes & (1U << (channel - 1)); }
+  void setMute(uint8_t channel, bool state);
+  uint8_t getArpStep(uint8_t idx) { return values.arpSteps[idx]; }
+  void setArpStep(uint8_t idx, uint8_t ratchets);
+  uint8_t getArpGate() { return values.arpGate; }
+  void setArpGate(uint8_t gate);
+  uint8_t getArpSwing() { return values.arpSwing; }
+  void setArpSwing(uint8_t swing);
+  bool getArpRetrigger() { return values.arpRetrigger == 1; }
+  void setArpRetrigger(bool state);
+  uint8_t getClockDivRatio() { return values.clockDivRatio; }
+  void setClockDivRatio(uint8_t ratio);
+};
+/* END SETTINGS CLASS */
+
+extern Settings settings;
+
+#endif // SETTINGS_H
@@ -0,0 +1,57 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+
+// Stops the compiler moving memory accesses across it, so an item is written
+// before the index that hands it over (the AVR itself doesn't reorder)
+#define SPSC_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// A single producer, single consumer ring buffer for passing events from an
+// interrupt to the main loop (or the other way) without turning interrupts
+// off. Only the producer writes head and only the consumer writes tail, and
+// both are single bytes, so every read and write of them is atomic on the AVR.
+// The indexes run freely and wrap at 256, so N has to be a power of two no
+// bigger than 128, and all N slots can be used.
+template <typename T, uint8_t N>
+class SpscRing {
+private:
+  T items[N];
+  volatile uint8_t head; // Next slot to write, producer only
+  volatile uint8_t tail; // Next slot to read, consumer only
+
+public:
+  SpscRing() {
+    head = 0;
+    tail = 0;
+  }
+
+  // Producer side, false if the ring is full and the item was dropped
+  bool push(const T &item) {
+    uint8_t h = head;
+    if ((uint8_t)(h - tail) >= N) return false;
+    items[h & (N - 1)] = item;
+    SPSC_BARRIER();
+    head = h + 1;
+    return true;
+  }
+
+  // Consumer side, false if there was nothing to take
+  bool pop(T &item) {
+    uint8_t t = tail;
+    if (t == head) return false;
+    SPSC_BARRIER();
+    item = items[t & (N - 1)];
+    SPSC_BARRIER();
+    tail = t + 1;
+    return true;
+  }
+
+  // Consumer side, throws away everything pushed so far
+  void clear() { tail = head; }
+
+  bool isEmpty() { return tail == head; }
+  uint8_t getCount() { return head - tail; }
+};
+
+#endif // SPSC_RING_H
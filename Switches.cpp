@@ -1,13 +1,115 @@
 #include "Switches.h"
+#include <util/atomic.h>
+
+/* BEGIN INPUT SCANNER CLASS */
+#ifdef INPUT_SCAN_ON_CHANGE
+static void wakeInputScanner() {
+  inputScanner.wake();
+}
+
+ISR(PCINT0_vect) {
+  inputScanner.wake();
+}
+#endif
+
+InputScanner::InputScanner() {
+  numInputs = 0;
+  historyIdx = 0;
+  stable = 0;
+  lastSampleMs = 0;
+  isSettled = true;
+  isDirty = true;
+  for (uint8_t i = 0; i < INPUT_DEBOUNCE_SAMPLES; i++) {
+    history[i] = 0;
+  }
+}
+
+uint8_t InputScanner::add(uint8_t pin) {
+  if (numInputs >= MAX_SCANNED_INPUTS) {
+    return MAX_SCANNED_INPUTS - 1; // Out of bits, share the last one
+  }
+  uint8_t bit = numInputs++;
+  inputRegs[bit] = portInputRegister(digitalPinToPort(pin));
+  inputMasks[bit] = digitalPinToBitMask(pin);
+
+  // Start from the pin's current state, so it can be read straight away
+  uint8_t mask = 1 << bit;
+  bool isHigh = *inputRegs[bit] & inputMasks[bit];
+  for (uint8_t i = 0; i < INPUT_DEBOUNCE_SAMPLES; i++) {
+    history[i] = isHigh ? history[i] | mask : history[i] & ~mask;
+  }
+  stable = isHigh ? stable | mask : stable & ~mask;
+
+#ifdef INPUT_SCAN_ON_CHANGE
+  // Wake on the pin's change interrupt, or its external interrupt if it
+  // doesn't have one (eg. the footswitches on port D)
+  if (digitalPinToPCICR(pin)) {
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    *digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
+  } else if (digitalPinToInterrupt(pin) != NOT_AN_INTERRUPT) {
+    attachInterrupt(digitalPinToInterrupt(pin), wakeInputScanner, CHANGE);
+  }
+#endif
+  return bit;
+}
+
+uint8_t InputScanner::readRaw() {
+  uint8_t raw = 0;
+  for (uint8_t i = 0; i < numInputs; i++) {
+    if (*inputRegs[i] & inputMasks[i]) raw |= 1 << i;
+  }
+  return raw;
+}
+
+void InputScanner::refresh() {
+  uint8_t now = millis();
+  if ((uint8_t)(now - lastSampleMs) < INPUT_SAMPLE_MS) {
+    return;
+  }
+  lastSampleMs = now;
+  sample();
+}
+
+void InputScanner::sample() {
+#ifdef INPUT_SCAN_ON_CHANGE
+  // Nothing has moved since everything settled
+  if (isSettled && !isDirty) {
+    return;
+  }
+#endif
+  isDirty = false;
+
+  history[historyIdx] = readRaw();
+  historyIdx = (historyIdx + 1) % INPUT_DEBOUNCE_SAMPLES;
+
+  // Inputs that were high in every sample go high, and low in every sample go low
+  uint8_t allHigh = 0xFF;
+  uint8_t anyHigh = 0;
+  for (uint8_t i = 0; i < INPUT_DEBOUNCE_SAMPLES; i++) {
+    allHigh &= history[i];
+    anyHigh |= history[i];
+  }
+  stable = (stable | allHigh) & anyHigh;
+  isSettled = allHigh == anyHigh;
+}
+
+void InputScanner::wake() { isDirty = true; }
+
+bool InputScanner::getValue(uint8_t bit) { return stable & (1 << bit); }
+/* END INPUT SCANNER CLASS */
 
 Switch::Switch(uint8_t _pin, uint8_t _mode) {
   pin = _pin;
   mode = _mode;
+  bit = 0;
 }
 
-void Switch::setup() { pinMode(pin, mode); }
+void Switch::setup() {
+  pinMode(pin, mode);
+  bit = inputScanner.add(pin);
+}
 
-void Switch::refresh() { value = digitalRead(pin); }
+void Switch::refresh() { value = inputScanner.getValue(bit); }
 
 bool Switch::getValue() { return value; }
 
@@ -26,8 +128,8 @@ SwEvent_t EventSwitch::getEvent() {
   bool currentValue = sw.getValue();
   unsigned long now = millis();
 
-  if (lastValue != currentValue && (now - lastDebounceTime > debounceDelay)) { // There's a change
-    lastDebounceTime = now;
+  // The input scanner has already debounced the value
+  if (lastValue != currentValue) { // There's a change
     lastValue = currentValue;
 
     // Switch is pressed
@@ -58,19 +160,14 @@ bool EventSwitch::getValue() {
 }
 
 RotarySwitch::RotarySwitch(uint8_t _pinA, uint8_t _pinB, uint8_t _pinC,
-                           uint8_t _pinD, uint8_t _mode) {
-  pinA = _pinA;
-  pinB = _pinB;
-  pinC = _pinC;
-  pinD = _pinD;
-  mode = _mode;
-}
+                           uint8_t _pinD, uint8_t _mode)
+    : swA(_pinA, _mode), swB(_pinB, _mode), swC(_pinC, _mode), swD(_pinD, _mode) {}
 
 void RotarySwitch::setup() {
-  pinMode(pinA, mode);
-  pinMode(pinB, mode);
-  pinMode(pinC, mode);
-  pinMode(pinD, mode);
+  swA.setup();
+  swB.setup();
+  swC.setup();
+  swD.setup();
   position = getRawPos();
   stablePosition = position;
   lastChange = millis();
@@ -98,22 +195,12 @@ bool RotarySwitch::refresh() {
 }
 
 uint8_t RotarySwitch::getRawPos() {
-  uint8_t pos = 0;
-  uint8_t mask = 0;
-
-  mask = digitalRead(pinA) << ROT_A_BIT;
-  pos |= mask;
-
-  mask = digitalRead(pinB) << ROT_B_BIT;
-  pos |= mask;
-
-  mask = digitalRead(pinC) << ROT_C_BIT;
-  pos |= mask;
-
-  mask = digitalRead(pinD) << ROT_D_BIT;
-  pos |= mask;
-
-  return pos;
+  swA.refresh();
+  swB.refresh();
+  swC.refresh();
+  swD.refresh();
+  return swA.getValue() << ROT_A_BIT | swB.getValue() << ROT_B_BIT |
+         swC.getValue() << ROT_C_BIT | swD.getValue() << ROT_D_BIT;
 }
 
 uint8_t RotarySwitch::getPosition() { return ROTARY_POS_MAP[stablePosition]; }
@@ -3,10 +3,50 @@
 
 #include "Globals.h"
 
+#define MAX_SCANNED_INPUTS 8
+#define INPUT_SAMPLE_MS 5      // How often the inputs are sampled
+#define INPUT_DEBOUNCE_SAMPLES 8 // Samples an input has to hold for (40ms)
+#define INPUT_SCAN_ON_CHANGE // Only sample after a pin change interrupt, comment out to always sample
+
+/* INPUT SCANNER CLASS */
+// Reads all the switch inputs straight from the port registers into one
+// bitmask, rather than a digitalRead (and its pin table lookups) per pin. Each
+// pin's register and mask are looked up once when it's added.
+// Debouncing is done on the whole bitmask at once: an input only changes once
+// it's read the same for the last INPUT_DEBOUNCE_SAMPLES samples.
+// With INPUT_SCAN_ON_CHANGE, the pins' change interrupts wake the scanner, so
+// once everything has settled, nothing is read until a switch moves.
+class InputScanner {
+private:
+  volatile uint8_t *inputRegs[MAX_SCANNED_INPUTS]; // Each input's port register
+  uint8_t inputMasks[MAX_SCANNED_INPUTS]; // Each input's bit in its port
+  uint8_t numInputs;
+  uint8_t history[INPUT_DEBOUNCE_SAMPLES]; // The last raw samples
+  uint8_t historyIdx;
+  uint8_t stable; // The debounced inputs, a bit per input
+  uint8_t lastSampleMs;
+  bool isSettled; // Have all the samples in the history agreed?
+  volatile bool isDirty; // Has a pin changed since the last sample?
+
+  uint8_t readRaw();
+
+public:
+  InputScanner();
+  uint8_t add(uint8_t pin); // Start scanning a pin, returns its bit
+  void refresh(); // Call every loop, samples every INPUT_SAMPLE_MS
+  void sample(); // Take a sample now, for callers that keep their own rate
+  void wake(); // Called from the pin change interrupts
+  bool getValue(uint8_t bit);
+};
+/* END INPUT SCANNER CLASS */
+
+extern InputScanner inputScanner;
+
 class Switch {
 private:
   uint8_t pin;
   uint8_t mode;
+  uint8_t bit; // The switch's bit in the input scanner
   bool value;
 
 public:
@@ -21,8 +61,6 @@ private:
   Switch sw;
   bool lastValue;
   unsigned long pressStartMs;
-  unsigned long lastDebounceTime;
-  const unsigned long debounceDelay = 50;
   bool isResetPress;
 
 public:
@@ -34,11 +72,10 @@ public:
 
 class RotarySwitch {
 private:
-  uint8_t pinA;
-  uint8_t pinB;
-  uint8_t pinC;
-  uint8_t pinD;
-  uint8_t mode;
+  Switch swA;
+  Switch swB;
+  Switch swC;
+  Switch swD;
   uint8_t position;
   uint8_t stablePosition;
   unsigned long lastChange;
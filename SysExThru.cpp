@@ -0,0 +1,142 @@
+#include "Arduino.h"
+#include "MIDIUSB.h"
+#include "Globals.h"
+#include "SysExThru.h"
+
+enum {
+  SYSEX_MODE_HEADER, // Collecting F0, ID and device to see who it's for
+  SYSEX_MODE_OWN, // For the pedal, collecting it
+  SYSEX_MODE_THRU // For someone else, passing it on
+};
+
+// USB midi code indexes for SysEx packets
+#define USB_CIN_SYSEX 0x4 // Start or carry on, three bytes
+#define USB_CIN_SYSEX_END 0x5 // Plus the bytes in the packet (1-3), ends it
+
+/* BEGIN SYSEX THRU CLASS */
+SysExThru::SysExThru() {
+  owner = SYSEX_NO_INPUT;
+  mode = SYSEX_MODE_HEADER;
+  size = 0;
+  packetSize = 0;
+  lastByteMs = 0;
+  handler = nullptr;
+}
+
+void SysExThru::setHandleOwn(SysExHandler_t func) { handler = func; }
+
+bool SysExThru::claim(uint8_t input) {
+  if (owner != SYSEX_NO_INPUT && owner != input) return false;
+  owner = input;
+  return true;
+}
+
+bool SysExThru::isOwner(uint8_t input) { return owner == input; }
+
+bool SysExThru::canWrite() {
+  // The header goes out in one go once it's known not to be for the pedal
+  return midiSerial.availableForWrite() >= 3;
+}
+
+void SysExThru::put(uint8_t b) {
+  lastByteMs = millis();
+  if (b == SYSEX_START) {
+    mode = SYSEX_MODE_HEADER;
+    size = 0;
+    packetSize = 0;
+  }
+
+  switch (mode) {
+  case SYSEX_MODE_HEADER:
+    buffer[size++] = b;
+    if (size < 3 && b != SYSEX_END) return;
+    if (size == 3 && buffer[1] == SYSEX_ID && buffer[2] == SYSEX_DEVICE) {
+      mode = SYSEX_MODE_OWN;
+      return;
+    }
+    mode = SYSEX_MODE_THRU;
+    for (uint8_t i = 0; i < size; i++) {
+      writeByte(buffer[i]);
+    }
+    break;
+  case SYSEX_MODE_OWN:
+    // Too long to be a request, it's dropped at the F7
+    if (size < SYSEX_OWN_SIZE) buffer[size] = b;
+    if (size < 0xFF) size++;
+    if (b == SYSEX_END) {
+      uint8_t input = owner;
+      release();
+      if (size <= SYSEX_OWN_SIZE && handler) handler(input, buffer, size);
+    }
+    return;
+  default:
+    writeByte(b);
+    break;
+  }
+
+  if (b == SYSEX_END) release();
+}
+
+void SysExThru::cancel() {
+  // Close it off so the receiver isn't left waiting for the rest
+  if (mode == SYSEX_MODE_THRU) writeByte(SYSEX_END);
+  release();
+}
+
+void SysExThru::refresh() {
+  if (owner != SYSEX_NO_INPUT && millis() - lastByteMs > SYSEX_TIMEOUT_MS) {
+    cancel();
+  }
+}
+
+bool SysExThru::isStreaming() {
+  return owner != SYSEX_NO_INPUT && mode == SYSEX_MODE_THRU;
+}
+
+bool SysExThru::isHolding() {
+  return isStreaming() || !deferred.isEmpty();
+}
+
+bool SysExThru::defer(midi::MidiType type, uint8_t data1, uint8_t data2, uint8_t channel) {
+  DeferredMidi_t msg = {(uint8_t) type, data1, data2, channel};
+  return deferred.push(msg);
+}
+
+void SysExThru::sendDeferred() {
+  DeferredMidi_t msg;
+  while (!isStreaming() && deferred.pop(msg)) {
+    if (msg.type == midi::MidiType::SongPosition) {
+      unsigned beats = msg.data1 | (msg.data2 << 7);
+      hardwareMIDI.sendSongPosition(beats);
+      usbMIDI.sendSongPosition(beats);
+    } else {
+      hardwareMIDI.send((midi::MidiType) msg.type, msg.data1, msg.data2, msg.channel);
+      usbMIDI.send((midi::MidiType) msg.type, msg.data1, msg.data2, msg.channel);
+    }
+  }
+}
+
+void SysExThru::release() {
+  if (mode == SYSEX_MODE_THRU) MidiUSB.flush();
+  owner = SYSEX_NO_INPUT;
+  mode = SYSEX_MODE_HEADER;
+}
+
+void SysExThru::writeByte(uint8_t b) {
+  midiSerial.write(b);
+
+  packet[packetSize++] = b;
+  if (b == SYSEX_END) sendPacket(USB_CIN_SYSEX_END + packetSize - 1);
+  else if (packetSize == 3) sendPacket(USB_CIN_SYSEX);
+}
+
+void SysExThru::sendPacket(uint8_t codeIndex) {
+  midiEventPacket_t event;
+  event.header = (USB_MIDI_CABLE << 4) | codeIndex;
+  event.byte1 = packet[0];
+  event.byte2 = packetSize > 1 ? packet[1] : 0;
+  event.byte3 = packetSize > 2 ? packet[2] : 0;
+  MidiUSB.sendMIDI(event);
+  packetSize = 0;
+}
+/* END SYSEX THRU CLASS */
@@ -0,0 +1,150 @@
+#ifndef SYSEX_THRU_H
+#define SYSEX_THRU_H
+
+#include <MIDI.h>
+#include <stdint.h>
+#include "SpscRing.h"
+
+#define SYSEX_START 0xF0
+#define SYSEX_END 0xF7
+#define SYSEX_OWN_SIZE 40 // Longest request to the pedal itself, F0 to F7
+#define SYSEX_NO_INPUT 0xFF
+#define SYSEX_TIMEOUT_MS 1000 // A message that stops for longer is ended, freeing the outputs
+#define SYSEX_DEFER_SIZE 32 // Messages held back while a dump goes out (a power of 2)
+
+typedef void (*SysExHandler_t)(uint8_t input, byte *data, unsigned size);
+
+// A message for both outputs that has to wait for the end of a dump
+typedef struct {
+  uint8_t type; // midi::MidiType
+  uint8_t data1;
+  uint8_t data2;
+  uint8_t channel;
+} DeferredMidi_t;
+
+/* SYSEX THRU CLASS */
+// Passes SysEx from an input straight out of both outputs as it comes in,
+// instead of the midi library collecting it into a buffer first (which cut
+// long dumps short). Nothing bigger than a USB packet is ever held, so a dump
+// can be any length. Only one input streams at a time, and SysEx from the
+// other one is dropped meanwhile, so two dumps never get mixed together (and
+// neither input is ever held up waiting). A message that stalls, eg. from a
+// pulled cable, is ended after SYSEX_TIMEOUT_MS so the other input can have
+// the outputs.
+// Requests to the pedal itself (F0 7D 4B ...) are short, so they're collected
+// and handed to the handler instead of being passed on.
+// Any other status byte on DIN would end the dump at the receiver, so while
+// one is going out only real-time messages are sent. Everything else (notes
+// from the effects or the other input, Song Position) is held back in order
+// and sent after the F7, and dropped if too much builds up.
+class SysExThru {
+private:
+  uint8_t owner; // The input streaming, SYSEX_NO_INPUT when there isn't one
+  uint8_t mode;
+  byte buffer[SYSEX_OWN_SIZE]; // The header while deciding, then a request to the pedal
+  uint8_t size;
+  uint8_t packet[3]; // The USB packet being filled
+  uint8_t packetSize;
+  uint32_t lastByteMs; // When the owner last sent a byte
+  SpscRing<DeferredMidi_t, SYSEX_DEFER_SIZE> deferred; // Held back until the dump ends, main loop only
+  SysExHandler_t handler;
+
+  void writeByte(uint8_t b);
+  void sendPacket(uint8_t codeIndex);
+  void release();
+
+public:
+  SysExThru();
+  void setHandleOwn(SysExHandler_t func);
+  bool claim(uint8_t input); // Call at the F0, false while the other input is streaming
+  bool isOwner(uint8_t input); // Does the input still have the outputs? Not once it's timed out
+  bool canWrite(); // Is there room on the outputs for the next bytes?
+  void put(uint8_t b); // The F0, data and F7 of the claimed input's message
+  void cancel(); // Another status byte ended the message without an F7
+  void refresh(); // Time out a stalled message, call regularly
+
+  bool isStreaming(); // Is a dump going out?
+  bool isHolding(); // Do messages for the outputs have to wait? (a dump, or ones already waiting)
+  bool defer(midi::MidiType type, uint8_t data1, uint8_t data2, uint8_t channel); // False if it was dropped
+  void sendDeferred(); // Send the held back messages once the dump has ended, call every loop
+};
+/* END SYSEX THRU CLASS */
+
+extern SysExThru sysExThru;
+
+/* SYSEX FILTER CLASS */
+// Sits between a midi interface and its transport (DIN serial or USB) and
+// takes the SysEx out of the incoming bytes for SysExThru, so the midi library
+// only sees everything else. Real-time bytes in the middle of a dump still go
+// to the library straight away. When the outputs are full the bytes of the
+// dump being streamed are left in the input until there's room. A message
+// that doesn't have the outputs is dropped up to its end.
+template <class T>
+class SysExFilter {
+private:
+  T &transport;
+  uint8_t input; // Which input this is, passed back to the handler
+  bool isInSysEx; // Between an F0 and its end, whether it's being streamed or dropped
+  bool hasLookahead;
+  byte lookahead; // A byte read for the library
+
+public:
+  static const bool thruActivated = T::thruActivated;
+
+  SysExFilter(T &transport, uint8_t input) : transport(transport), input(input) {
+    isInSysEx = false;
+    hasLookahead = false;
+    lookahead = 0;
+  }
+
+  void begin() { transport.begin(); }
+  bool beginTransmission(midi::MidiType type) { return transport.beginTransmission(type); }
+  void write(byte value) { transport.write(value); }
+  void endTransmission() { transport.endTransmission(); }
+
+  unsigned available() {
+    if (hasLookahead) return 1;
+
+    while (transport.available()) {
+      bool isStreaming = isInSysEx && sysExThru.isOwner(input);
+      if (isStreaming && !sysExThru.canWrite()) return 0;
+
+      byte b = transport.read();
+      if (b >= 0xF8) {
+        // Real-time, allowed anywhere
+        lookahead = b;
+        hasLookahead = true;
+        return 1;
+      }
+
+      if (isInSysEx) {
+        if (b < 0x80 || b == SYSEX_END) {
+          if (isStreaming) sysExThru.put(b);
+          if (b == SYSEX_END) isInSysEx = false;
+          continue;
+        }
+        if (isStreaming) sysExThru.cancel();
+        isInSysEx = false;
+      }
+
+      if (b == SYSEX_START) {
+        isInSysEx = true;
+        if (sysExThru.claim(input)) sysExThru.put(b);
+        continue;
+      }
+
+      lookahead = b;
+      hasLookahead = true;
+      return 1;
+    }
+    return 0;
+  }
+
+  byte read() {
+    hasLookahead = false;
+    return lookahead;
+  }
+};
+/* END SYSEX FILTER CLASS */
+
+#endif // SYSEX_THRU_H
@@ -0,0 +1,164 @@
+#include "Arduino.h"
+#include "TapTempo.h"
+#include "Switches.h"
+
+static void handleTapEdge() {
+  tapTempo.handleEdge();
+}
+
+TapTempo::TapTempo(uint8_t _pin) {
+  pin = _pin;
+  pinReg = nullptr;
+  pinMask = 0;
+  lastEdgeTick = 0;
+  isReleased = true;
+  quarterTicks = 500 * TICKS_PER_MS; // 120 BPM
+  previousQuarterTicks = quarterTicks;
+  isLastTapNew = false;
+  reset();
+}
+
+void TapTempo::begin() {
+  pinReg = portInputRegister(digitalPinToPort(pin));
+  pinMask = digitalPinToBitMask(pin);
+  attachInterrupt(digitalPinToInterrupt(pin), handleTapEdge, CHANGE);
+}
+
+void TapTempo::reset() {
+  taps.clear();
+  numIntervals = 0;
+  hasLastTap = false;
+  lastOutlier = 0;
+}
+
+void TapTempo::handleEdge() {
+  Tick_t now = micros();
+  bool isPressed = !(*pinReg & pinMask);
+
+  // This replaces the input scanner's wake up on the same pin
+  inputScanner.wake();
+
+  // Contact bounce on the press or the release would look like more taps, so
+  // only count a press after the switch has been let go for a while
+  if (isPressed && isReleased && now - lastEdgeTick >= TAP_DEBOUNCE_TICKS) {
+    taps.push(now); // Dropped if the main loop hasn't taken the last 4
+    isReleased = false;
+  } else if (!isPressed) {
+    isReleased = true;
+  }
+  lastEdgeTick = now;
+}
+
+bool TapTempo::update() {
+  bool isNew = false;
+  Tick_t tick;
+  while (taps.pop(tick)) {
+    Tick_t before = quarterTicks;
+    addTap(tick);
+    isLastTapNew = quarterTicks != before;
+    if (isLastTapNew) previousQuarterTicks = before;
+    isNew |= isLastTapNew;
+  }
+  return isNew;
+}
+
+bool TapTempo::cancelTap() {
+  reset();
+  if (!isLastTapNew) return false;
+  quarterTicks = previousQuarterTicks;
+  isLastTapNew = false;
+  return true;
+}
+
+void TapTempo::addTap(Tick_t tick) {
+  // Too long since the last tap, so start again from this one
+  if (!hasLastTap || tick - lastTapTick > TAP_TIMEOUT_TICKS) {
+    numIntervals = 0;
+    lastOutlier = 0;
+    lastTapTick = tick;
+    hasLastTap = true;
+    return;
+  }
+
+  Tick_t interval = tick - lastTapTick;
+  lastTapTick = tick;
+
+  if (numIntervals >= 2) {
+    Tick_t median = getMedian();
+    if (!isClose(interval, median)) {
+      // Two off intervals in a row that agree with each other are a new tempo
+      if (lastOutlier != 0 && isClose(interval, lastOutlier)) {
+        numIntervals = 0;
+        pushInterval(lastOutlier);
+        pushInterval(interval);
+        lastOutlier = 0;
+        return; // Used once the next tap agrees
+      }
+      lastOutlier = interval;
+
+      // A missed or double tap is thrown out
+      Tick_t diff = interval > median ? interval - median : median - interval;
+      if (diff > median >> TAP_OUTLIER_SHIFT) {
+        return;
+      }
+    } else {
+      lastOutlier = 0;
+    }
+  }
+  pushInterval(interval);
+  estimate();
+}
+
+bool TapTempo::isClose(Tick_t interval, Tick_t reference) {
+  Tick_t diff = interval > reference ? interval - reference : reference - interval;
+  return diff <= reference >> TAP_CLOSE_SHIFT;
+}
+
+void TapTempo::pushInterval(Tick_t interval) {
+  if (numIntervals == TAP_MAX_INTERVALS) {
+    for (uint8_t i = 1; i < TAP_MAX_INTERVALS; i++) {
+      intervals[i - 1] = intervals[i];
+    }
+    numIntervals--;
+  }
+  intervals[numIntervals++] = interval;
+}
+
+Tick_t TapTempo::getMedian() {
+  // Insertion sort a copy, there are only a few
+  Tick_t sorted[TAP_MAX_INTERVALS];
+  for (uint8_t i = 0; i < numIntervals; i++) {
+    Tick_t value = intervals[i];
+    uint8_t j = i;
+    while (j > 0 && sorted[j - 1] > value) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+
+  uint8_t mid = numIntervals / 2;
+  if (numIntervals & 1) {
+    return sorted[mid];
+  }
+  return (sorted[mid - 1] + sorted[mid]) / 2;
+}
+
+void TapTempo::estimate() {
+  // One or two intervals could be a stray press
+  if (numIntervals < TAP_MIN_INTERVALS) return;
+
+  // Average the intervals close to the median, so a late tap doesn't pull it
+  Tick_t median = getMedian();
+  Tick_t sum = 0;
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < numIntervals; i++) {
+    if (isClose(intervals[i], median)) {
+      sum += intervals[i];
+      count++;
+    }
+  }
+  quarterTicks = count > 0 ? sum / count : median;
+}
+
+Tick_t TapTempo::getQuarterTicks() { return quarterTicks; }
@@ -0,0 +1,62 @@
+#ifndef TAP_TEMPO_H
+#define TAP_TEMPO_H
+
+#include "Globals.h"
+#include "Timebase.h"
+#include "SpscRing.h"
+
+#define TAP_QUEUE_SIZE 4      // Taps the interrupt can hold for the main loop (a power of 2)
+#define TAP_MIN_INTERVALS 3   // Tap intervals needed before there's a tempo
+#define TAP_MAX_INTERVALS 8   // The most recent tap intervals used for the tempo
+#define TAP_DEBOUNCE_TICKS (20 * TICKS_PER_MS) // The switch has to be released this long before a press counts
+#define TAP_TIMEOUT_TICKS (2000 * TICKS_PER_MS) // A longer gap starts a new run of taps (30 BPM)
+#define TAP_OUTLIER_SHIFT 2   // An interval more than 1/4 away from the median is thrown out
+#define TAP_CLOSE_SHIFT 4     // Intervals within 1/16 of the median count as the same tempo
+
+/* TAP TEMPO CLASS */
+// Timestamps the external footswitch presses from its pin change interrupt, so
+// a tap is timed from the press itself (to the microsecond) rather than from
+// the debounced release seen by the main loop.
+// The tempo comes from the last 3-8 tap intervals, and there isn't one until
+// there are 3. The median throws out a missed or double tap, and the intervals
+// close to it are averaged. Two intervals in a row that are off the tempo but
+// agree with each other start a new tempo, so it follows a change after four
+// taps.
+class TapTempo {
+private:
+  uint8_t pin;
+  volatile uint8_t *pinReg; // The pin's port register, read directly in the interrupt
+  uint8_t pinMask;
+  SpscRing<Tick_t, TAP_QUEUE_SIZE> taps; // Tap times waiting for the main loop
+  Tick_t lastEdgeTick; // When the pin last changed, interrupt only
+  bool isReleased; // Has the switch been let go since the last tap? Interrupt only
+
+  Tick_t intervals[TAP_MAX_INTERVALS]; // Oldest first
+  uint8_t numIntervals;
+  Tick_t lastTapTick;
+  bool hasLastTap;
+  Tick_t lastOutlier; // The last interval thrown out, 0 if the last one wasn't
+  Tick_t quarterTicks; // The current estimate
+  Tick_t previousQuarterTicks; // The estimate before the last tap changed it
+  bool isLastTapNew; // Did the last tap change the estimate?
+
+  void addTap(Tick_t tick);
+  void pushInterval(Tick_t interval);
+  bool isClose(Tick_t interval, Tick_t reference);
+  Tick_t getMedian();
+  void estimate();
+
+public:
+  TapTempo(uint8_t _pin);
+  void begin(); // Start timing presses
+  void reset(); // Forget the taps so far
+  bool cancelTap(); // The last press wasn't a tap (eg. a long press), true if the tempo it set was undone
+  void handleEdge(); // Called from the pin change interrupt
+  bool update(); // Call every loop, true if there's a new tempo
+  Tick_t getQuarterTicks();
+};
+/* END TAP TEMPO CLASS */
+
+extern TapTempo tapTempo;
+
+#endif // TAP_TEMPO_H
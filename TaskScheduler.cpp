@@ -0,0 +1,89 @@
+#include "Arduino.h"
+#include "TaskScheduler.h"
+
+/* BEGIN TASK SCHEDULER CLASS */
+TaskScheduler::TaskScheduler() {
+  numTasks = 0;
+}
+
+uint8_t TaskScheduler::add(TaskFunc_t run, Tick_t period) {
+  if (numTasks >= MAX_TASKS) return numTasks;
+
+  Task_t &task = tasks[numTasks];
+  task.run = run;
+  task.period = period;
+  task.nextTick = nowTicks();
+  task.lastTicks = 0;
+  task.maxTicks = 0;
+  task.meanTicks = 0;
+  task.late = 0;
+  return numTasks++;
+}
+
+static uint16_t clampTicks(Tick_t ticks) {
+  return ticks > UINT16_MAX ? UINT16_MAX : ticks;
+}
+
+void TaskScheduler::runTask(Task_t &task) {
+  Tick_t start = nowTicks();
+  task.run();
+  uint16_t ticks = clampTicks(nowTicks() - start);
+
+  task.lastTicks = ticks;
+  if (ticks > task.maxTicks) task.maxTicks = ticks;
+  // Average over roughly the last 8 runs
+  task.meanTicks = task.meanTicks + ((int32_t)ticks - task.meanTicks) / 8;
+}
+
+void TaskScheduler::run() {
+  for (uint8_t i = 0; i < numTasks; i++) {
+    if (tasks[i].period == 0) runTask(tasks[i]);
+  }
+
+  Tick_t now = nowTicks();
+  for (uint8_t i = 0; i < numTasks; i++) {
+    Task_t &task = tasks[i];
+    if (task.period == 0 || !tickReached(now, task.nextTick)) continue;
+
+    uint16_t late = clampTicks(now - task.nextTick);
+    if (late > task.late) task.late = late;
+
+    // Keep to the fixed rate, but don't try to catch up on missed runs
+    task.nextTick += task.period;
+    if (tickReached(now, task.nextTick)) task.nextTick = now + task.period;
+
+    runTask(task);
+    break; // Only one fixed rate task per pass
+  }
+}
+
+void TaskScheduler::resetStats() {
+  for (uint8_t i = 0; i < numTasks; i++) {
+    tasks[i].lastTicks = 0;
+    tasks[i].maxTicks = 0;
+    tasks[i].meanTicks = 0;
+    tasks[i].late = 0;
+  }
+}
+
+static uint8_t packWord(uint8_t *out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+  return 2;
+}
+
+uint8_t TaskScheduler::buildReply(uint8_t id, uint8_t *out) {
+  uint8_t raw[TASK_REPLY_SIZE];
+  uint8_t len = 0;
+  raw[len++] = id;
+  len += packWord(raw + len, tasks[id].lastTicks);
+  len += packWord(raw + len, tasks[id].maxTicks);
+  len += packWord(raw + len, tasks[id].meanTicks);
+  len += packWord(raw + len, tasks[id].late);
+
+  out[0] = SYSEX_ID;
+  out[1] = SYSEX_DEVICE;
+  out[2] = SYSEX_TASK_STATS;
+  return 3 + midi::encodeSysEx(raw, out + 3, TASK_REPLY_SIZE);
+}
+/* END TASK SCHEDULER CLASS */
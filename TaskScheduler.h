@@ -0,0 +1,51 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include "Globals.h"
+#include "Timebase.h"
+
+#define MAX_TASKS 6
+#define TASK_REPLY_SIZE 9 // Bytes in a task's reply, before 7 bit encoding
+
+typedef void (*TaskFunc_t)();
+
+typedef struct {
+  TaskFunc_t run;
+  Tick_t period;     // Ticks between runs, 0 runs the task on every pass
+  Tick_t nextTick;   // When the task is next due
+  uint16_t lastTicks; // How long the last run took
+  uint16_t maxTicks;  // The longest run so far
+  uint16_t meanTicks; // Running average of the run time
+  uint16_t late;      // The latest the task has been started after it was due
+} Task_t;
+
+/* TASK SCHEDULER CLASS */
+// Runs the main loop's work as a table of tasks. Tasks with no period run on
+// every pass (midi in and out), the rest run at a fixed rate. At most one
+// fixed rate task runs per pass, so the every pass tasks are never held up by
+// more than the longest single task. Tasks are checked in the order they were
+// added, so add the most important first.
+//
+// Run times are read with a SysEx request (F0 7D 4B 03 F7), which gets one
+// reply per task: F0 7D 4B 03 <7 bit encoded: id, last, max, mean, late> F7
+// All the values are 16 bit little endian ticks (us).
+class TaskScheduler {
+private:
+  Task_t tasks[MAX_TASKS];
+  uint8_t numTasks;
+
+  void runTask(Task_t &task);
+
+public:
+  TaskScheduler();
+  uint8_t add(TaskFunc_t run, Tick_t period); // Returns the task's id
+  void run(); // Call every loop
+  void resetStats();
+  uint8_t getNumTasks() { return numTasks; }
+  uint8_t buildReply(uint8_t id, uint8_t *out); // SysEx reply for a task, without F0/F7
+};
+/* END TASK SCHEDULER CLASS */
+
+extern TaskScheduler taskScheduler;
+
+#endif // TASK_SCHEDULER_H
@@ -0,0 +1,84 @@
+#include "TempoTracker.h"
+
+TempoTracker::TempoTracker() {
+  periodQ8 = 0;
+  phaseTick = 0;
+  missed = 0;
+  lastArrivalTick = 0;
+  reset();
+}
+
+void TempoTracker::reset() {
+  seedPulses = 0;
+  jumpCount = 0;
+}
+
+void TempoTracker::seed(Tick_t now) {
+  seedTick = now;
+  lastArrivalTick = now;
+  phaseTick = now;
+  seedPulses = 1;
+  jumpCount = 0;
+}
+
+bool TempoTracker::pulse(Tick_t now) {
+  missed = 0;
+  if (seedPulses == 0) {
+    seed(now);
+    return false;
+  }
+
+  // Average the first pulses to get close quickly
+  if (seedPulses < TEMPO_SEED_PULSES) {
+    if (now - phaseTick > CLOCK_TIMEOUT * TICKS_PER_MS) {
+      seed(now); // Too long a gap to be the same clock
+      return false;
+    }
+    periodQ8 = ((now - seedTick) << TICK_FRAC_BITS) / seedPulses;
+    phaseTick = now;
+    lastArrivalTick = now;
+    seedPulses++;
+    return true;
+  }
+
+  // Where the pulse is on the old tempo's grid, from the last pulse that was
+  // on time. Off pulses since then don't move the phase
+  Tick_t period = periodQ8 >> TICK_FRAC_BITS;
+  Tick_t elapsed = now - phaseTick;
+  uint32_t periods = (elapsed + period / 2) / period;
+  int32_t error = (int32_t)(elapsed - periods * period);
+  int32_t gapError = (int32_t)(now - lastArrivalTick - period);
+  lastArrivalTick = now;
+
+  // On time means on the grid and a pulse after the last one, so a gap only
+  // counts as missing pulses once the pulse after it confirms the old tempo
+  int32_t tolerance = period / 4;
+  bool isOnTime = periods >= 1 && periods <= 1u + jumpCount + TEMPO_MAX_MISSED &&
+                  error <= tolerance && error >= -tolerance &&
+                  gapError <= tolerance && gapError >= -tolerance;
+  if (!isOnTime) {
+    if (++jumpCount >= TEMPO_JUMP_PULSES) {
+      seed(now); // Keep the old tempo until the new one is known
+    }
+    return false;
+  }
+
+  // The off pulses were each counted as one, the rest of the grid went missing
+  if (periods > 1u + jumpCount) {
+    missed = periods - 1 - jumpCount;
+  }
+  jumpCount = 0;
+
+  phaseTick += periods * period + (error >> TEMPO_PHASE_SHIFT);
+  int32_t adjust = (error * (int32_t)(1 << TICK_FRAC_BITS) / (int32_t)periods) >> TEMPO_PERIOD_SHIFT;
+  periodQ8 += adjust;
+  return true;
+}
+
+bool TempoTracker::isLocked() { return seedPulses > 1; }
+
+uint8_t TempoTracker::getMissed() { return missed; }
+
+uint32_t TempoTracker::getPeriodQ8() { return periodQ8; }
+
+Tick_t TempoTracker::getPhaseTick() { return phaseTick; }
@@ -0,0 +1,51 @@
+#ifndef TEMPO_TRACKER_H
+#define TEMPO_TRACKER_H
+
+#include "Timebase.h"
+
+#define TEMPO_SEED_PULSES 8   // Pulses averaged before the filter takes over
+#define TEMPO_PHASE_SHIFT 2   // Phase follows 1/4 of each pulse's error
+#define TEMPO_PERIOD_SHIFT 5  // Period follows 1/32 of each pulse's error
+#define TEMPO_MAX_MISSED 4    // Missed pulses that can be bridged
+#define TEMPO_JUMP_PULSES 3   // Pulses in a row off the old tempo before starting again
+#define TEMPO_STABLE_SHIFT 10 // Changes under 1/1024 of the period are ignored
+
+/* TEMPO TRACKER CLASS */
+// Estimates the tempo and phase of the incoming midi clock. Rather than taking
+// the gap between the last two pulses, each pulse is compared with where the
+// tracker predicted it, and the phase and period are nudged by a fraction of
+// the error (an alpha-beta filter, like a software PLL). A single late pulse
+// then only moves the tempo slightly.
+// The first pulses are averaged to find the tempo quickly. A pulse off the
+// prediction (more than a quarter of a pulse, or a gap that isn't one pulse
+// long) doesn't move the estimate. When the next pulse is back on the old
+// tempo, a pulse a whole period after the last, the pulses that went missing
+// in between are counted so the position doesn't fall behind. A gap alone is
+// never enough, since the tempo halving looks the same. Several off pulses in
+// a row are a tempo change (or the clock restarting), and start again.
+class TempoTracker {
+private:
+  Tick_t phaseTick; // When the last pulse should have arrived
+  uint32_t periodQ8; // The estimated pulse length (Q24.8)
+  Tick_t seedTick; // When the first pulse of the seed arrived
+  uint8_t seedPulses; // Pulses counted since the seed started, 0 if not started
+  Tick_t lastArrivalTick; // When the last pulse arrived, on time or not
+  uint8_t jumpCount; // Pulses in a row that were off the prediction
+  uint8_t missed; // Pulses that went missing before the last pulse
+
+  void seed(Tick_t now);
+
+public:
+  TempoTracker();
+  bool pulse(Tick_t now); // Add a pulse, true if it updated the tempo and phase
+  void reset(); // Forget the tempo, eg. when the clock stops
+  bool isLocked(); // Is the tempo known?
+  uint8_t getMissed(); // Pulses that went missing before the last one
+  uint32_t getPeriodQ8();
+  Tick_t getPhaseTick();
+};
+/* END TEMPO TRACKER CLASS */
+
+extern TempoTracker tempoTracker;
+
+#endif // TEMPO_TRACKER_H
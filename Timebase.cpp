@@ -0,0 +1,126 @@
+#include "Arduino.h"
+#include "Timebase.h"
+#include "MasterClock.h"
+#include "TempoTracker.h"
+
+Timebase::Timebase() {
+  lastPulseTick = 0;
+  hasPulse = false;
+  pulseCount = 0;
+  tempoSerial = 0;
+  pulsePeriodQ8 = 0;
+  internalQuarterTicks = 500 * TICKS_PER_MS; // 120 BPM
+  setQuarter(internalQuarterTicks);
+}
+
+void Timebase::setPulsePeriodQ8(uint32_t periodQ8) {
+  if (periodQ8 == pulsePeriodQ8) {
+    return;
+  }
+  pulsePeriodQ8 = periodQ8;
+  if (!hasPulse) {
+    masterClock.setPulsePeriodQ8(periodQ8);
+  }
+
+  // Split the multiply so long periods can't overflow
+  quarterTicks = (periodQ8 >> TICK_FRAC_BITS) * MIDI_CLOCKS_PER_QUARTER +
+                 (((periodQ8 & 0xFF) * MIDI_CLOCKS_PER_QUARTER) >> TICK_FRAC_BITS);
+
+  // A pulse is POS_PER_PULSE positions long
+  Tick_t pulseTicks = periodQ8 >> TICK_FRAC_BITS;
+  posPerTickQ16 = (POS_PER_PULSE << 16) / (pulseTicks > 0 ? pulseTicks : 1);
+  tempoSerial++;
+}
+
+void Timebase::clockPulse(Tick_t now) {
+  if (!hasPulse) {
+    masterClock.stop(); // Midi clock takes over from the master clock
+    tempoTracker.reset();
+  }
+
+  lastPulseTick = now;
+  if (tempoTracker.pulse(now)) {
+    // Small wobbles in the estimate don't count as a tempo change
+    uint32_t periodQ8 = tempoTracker.getPeriodQ8();
+    uint32_t diff = periodQ8 > pulsePeriodQ8 ? periodQ8 - pulsePeriodQ8 : pulsePeriodQ8 - periodQ8;
+    if (diff > (pulsePeriodQ8 >> TEMPO_STABLE_SHIFT)) {
+      setPulsePeriodQ8(periodQ8);
+    }
+
+    // Interpolate from where the pulse should have been, not when it arrived
+    if (tickReached(now, tempoTracker.getPhaseTick())) {
+      lastPulseTick = tempoTracker.getPhaseTick();
+    }
+  }
+  pulseCount += 1 + tempoTracker.getMissed();
+  hasPulse = true;
+}
+
+void Timebase::setQuarter(Tick_t ticks) {
+  if (ticks == 0) {
+    return;
+  }
+  setPulsePeriodQ8((ticks << TICK_FRAC_BITS) / MIDI_CLOCKS_PER_QUARTER);
+}
+
+void Timebase::setInternalQuarter(Tick_t ticks) {
+  internalQuarterTicks = ticks;
+  if (!hasPulse) {
+    setQuarter(ticks);
+  }
+}
+
+void Timebase::refresh(Tick_t now) {
+  // Clock has timed out, so go back to the internal tempo
+  if (hasPulse && now - lastPulseTick > CLOCK_TIMEOUT * TICKS_PER_MS) {
+    hasPulse = false;
+    setQuarter(internalQuarterTicks);
+  }
+
+  // Without midi clock, count the master clock's pulses
+  if (!hasPulse) {
+    if (!masterClock.getIsRunning()) {
+      lastPulseTick = now;
+      masterClock.start(now, pulsePeriodQ8);
+    }
+
+    Tick_t lastTick;
+    uint8_t pulses = masterClock.takePulses(lastTick);
+    if (pulses > 0) {
+      lastPulseTick = lastTick;
+      pulseCount += pulses;
+    }
+  }
+}
+
+bool Timebase::hasExternalClock() { return hasPulse; }
+
+Tick_t Timebase::getQuarterTicks() { return quarterTicks; }
+
+Tick_t Timebase::getPulseTicks() { return pulsePeriodQ8 >> TICK_FRAC_BITS; }
+
+Tick_t Timebase::getTicksForPulses(uint16_t pulses) {
+  return (pulsePeriodQ8 >> TICK_FRAC_BITS) * pulses +
+         (((pulsePeriodQ8 & 0xFF) * pulses) >> TICK_FRAC_BITS);
+}
+
+uint8_t Timebase::getTempoSerial() { return tempoSerial; }
+
+Pos_t Timebase::getPosition(Tick_t now) {
+  Tick_t elapsed = now - lastPulseTick;
+  uint32_t fraction = POS_PER_PULSE - 1;
+
+  // Hold at the end of the pulse until the next one arrives
+  if (elapsed < (pulsePeriodQ8 >> TICK_FRAC_BITS)) {
+    fraction = (elapsed * posPerTickQ16) >> 16;
+    if (fraction >= POS_PER_PULSE) fraction = POS_PER_PULSE - 1;
+  }
+  return pulseCount * POS_PER_PULSE + fraction;
+}
+
+Pos_t Timebase::getPulsePosition() { return pulseCount * POS_PER_PULSE; }
+
+Pos_t Timebase::ticksToPos(Tick_t ticks) {
+  // Split the multiply so long lengths can't overflow
+  return (((ticks >> 8) * posPerTickQ16) >> 8) + (((ticks & 0xFF) * posPerTickQ16) >> 16);
+}
@@ -0,0 +1,76 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include "Globals.h"
+#include <stdint.h>
+
+/* TICKS */
+// A tick is one microsecond. Periods are kept in Q24.8 fixed point ticks so
+// dividing a quarter note into pulses or steps doesn't lose the remainder.
+typedef uint32_t Tick_t;
+
+#define TICKS_PER_MS 1000UL
+#define TICK_FRAC_BITS 8
+
+// The current time in ticks (wraps roughly every 71 minutes)
+inline Tick_t nowTicks() { return micros(); }
+
+// Has time 't' been reached? Safe across the tick counter wrapping
+inline bool tickReached(Tick_t now, Tick_t t) { return (int32_t)(now - t) >= 0; }
+
+/* POSITIONS */
+// A position counts clock pulses in Q24.8 fixed point. With midi clock it
+// advances exactly one pulse per received pulse (with the fraction in between
+// interpolated from the tempo), so anything scheduled in positions stays
+// locked to the source clock. Without clock, the timebase counts its own pulses.
+typedef uint32_t Pos_t;
+
+#define POS_PER_PULSE 256UL
+
+// Has position 'p' been reached? Safe across the position counter wrapping
+inline bool posReached(Pos_t now, Pos_t p) { return (int32_t)(now - p) >= 0; }
+
+/* TIMEBASE CLASS */
+// Holds the current tempo, shared by all effects. The tempo either follows the
+// incoming 24 PPQN midi clock, or falls back to the internal quarter note
+// length (tap tempo) once the clock has timed out, where the pulses come from
+// the timer driven MasterClock.
+// Effects should cache any intervals derived from it and only recalculate
+// them when getTempoSerial() changes.
+// It's only used from the main loop (the midi handlers run from the reads
+// there), the master clock's pulses are taken from its interrupt in refresh().
+class Timebase {
+private:
+  Tick_t lastPulseTick; // When the last clock pulse arrived
+  bool hasPulse; // Has a clock pulse arrived since the clock timed out?
+  uint32_t pulseCount; // The number of clock pulses counted (midi or internal)
+  uint32_t posPerTickQ16; // How far the position moves per tick (Q16.16)
+  uint32_t pulsePeriodQ8; // The length of one clock pulse in ticks (Q24.8)
+  Tick_t quarterTicks; // The length of a quarter note in ticks
+  Tick_t internalQuarterTicks; // The quarter note length to use without midi clock
+  uint8_t tempoSerial; // Incremented every time the tempo changes
+
+  void setPulsePeriodQ8(uint32_t periodQ8);
+
+public:
+  Timebase();
+  void clockPulse(Tick_t now); // Call for every incoming midi clock pulse
+  void setQuarter(Tick_t ticks); // Set the tempo from a quarter note length
+  void setInternalQuarter(Tick_t ticks); // Set the tempo to fall back to without midi clock
+  void refresh(Tick_t now); // Call every loop to handle the clock timing out and count master clock pulses
+  bool hasExternalClock(); // Has midi clock been received recently?
+
+  Tick_t getQuarterTicks();
+  Tick_t getPulseTicks();
+  Tick_t getTicksForPulses(uint16_t pulses); // The length of a number of clock pulses
+  uint8_t getTempoSerial();
+
+  Pos_t getPosition(Tick_t now); // The current position, including the fraction of a pulse
+  Pos_t getPulsePosition(); // The position of the last pulse
+  Pos_t ticksToPos(Tick_t ticks); // Convert a length of time to a length in positions
+};
+/* END TIMEBASE CLASS */
+
+extern Timebase timebase;
+
+#endif // TIMEBASE_H
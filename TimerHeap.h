@@ -0,0 +1,116 @@
+#ifndef TIMER_HEAP_H
+#define TIMER_HEAP_H
+
+#include <stdint.h>
+
+#define TIMER_HEAP_NONE 0xFF
+
+// An indexed binary min-heap of deadlines. Each slot (0 to N-1) has at most one
+// deadline, so an owner can keep its own per-slot data (eg. a delay voice) and
+// only look at the slots that are actually due, instead of scanning them all.
+// Deadlines are compared wrap-safe, so free running timestamps can be used.
+template <uint8_t N>
+class TimerHeap {
+private:
+  uint32_t due[N]; // The deadline for each slot
+  uint8_t heap[N]; // Slots ordered so the earliest deadline is at the top
+  uint8_t pos[N];  // Where each slot is in the heap (TIMER_HEAP_NONE if not scheduled)
+  uint8_t count;   // Number of scheduled slots
+
+  static bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+  void place(uint8_t idx, uint8_t slot) {
+    heap[idx] = slot;
+    pos[slot] = idx;
+  }
+
+  void siftUp(uint8_t idx) {
+    uint8_t slot = heap[idx];
+    while (idx > 0) {
+      uint8_t parent = (idx - 1) / 2;
+      if (!before(due[slot], due[heap[parent]])) break;
+      place(idx, heap[parent]);
+      idx = parent;
+    }
+    place(idx, slot);
+  }
+
+  void siftDown(uint8_t idx) {
+    uint8_t slot = heap[idx];
+    while (true) {
+      uint8_t child = idx * 2 + 1;
+      if (child >= count) break;
+      if (child + 1 < count && before(due[heap[child + 1]], due[heap[child]])) {
+        child++;
+      }
+      if (!before(due[heap[child]], due[slot])) break;
+      place(idx, heap[child]);
+      idx = child;
+    }
+    place(idx, slot);
+  }
+
+  void removeAt(uint8_t idx) {
+    uint8_t slot = heap[idx];
+    pos[slot] = TIMER_HEAP_NONE;
+    count--;
+    if (idx == count) return;
+
+    // Move the last entry into the gap and restore the order
+    place(idx, heap[count]);
+    if (idx > 0 && before(due[heap[idx]], due[heap[(idx - 1) / 2]])) {
+      siftUp(idx);
+    } else {
+      siftDown(idx);
+    }
+  }
+
+public:
+  TimerHeap() { clear(); }
+
+  // Set (or move) the deadline of a slot
+  void schedule(uint8_t slot, uint32_t time) {
+    if (slot >= N) return;
+
+    if (pos[slot] == TIMER_HEAP_NONE) {
+      due[slot] = time;
+      place(count, slot);
+      count++;
+      siftUp(count - 1);
+    } else {
+      bool earlier = before(time, due[slot]);
+      due[slot] = time;
+      if (earlier) siftUp(pos[slot]);
+      else siftDown(pos[slot]);
+    }
+  }
+
+  // Remove a slot's deadline (does nothing if it isn't scheduled)
+  void cancel(uint8_t slot) {
+    if (slot < N && pos[slot] != TIMER_HEAP_NONE) {
+      removeAt(pos[slot]);
+    }
+  }
+
+  // Remove and return the earliest slot if its deadline has been reached,
+  // otherwise return -1
+  int16_t popDue(uint32_t now) {
+    if (count == 0 || before(now, due[heap[0]])) return -1;
+    uint8_t slot = heap[0];
+    removeAt(0);
+    return slot;
+  }
+
+  bool isScheduled(uint8_t slot) { return slot < N && pos[slot] != TIMER_HEAP_NONE; }
+  uint32_t getDue(uint8_t slot) { return due[slot]; }
+  uint8_t getCount() { return count; }
+
+  void clear() {
+    count = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      pos[i] = TIMER_HEAP_NONE;
+    }
+  }
+};
+
+#endif // TIMER_HEAP_H
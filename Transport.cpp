@@ -0,0 +1,77 @@
+#include "Transport.h"
+
+Transport::Transport() {
+  state = TRANSPORT_FREE;
+  songPulse = 0;
+  nextSongPulse = 0;
+  armedTick = 0;
+}
+
+void Transport::arm(Tick_t now) {
+  state = TRANSPORT_ARMED;
+  armedTick = now;
+}
+
+void Transport::start(Tick_t now) {
+  nextSongPulse = 0;
+  arm(now);
+}
+
+void Transport::resume(Tick_t now) {
+  if (state != TRANSPORT_PLAYING) {
+    arm(now);
+  }
+}
+
+bool Transport::stop() {
+  // Without clock there's nothing to freeze
+  if (state == TRANSPORT_STOPPED || !timebase.hasExternalClock()) {
+    return false;
+  }
+  state = TRANSPORT_STOPPED;
+  return true;
+}
+
+void Transport::setSongPosition(uint16_t beats) {
+  nextSongPulse = (uint32_t)beats * MIDI_CLOCKS_PER_BEAT;
+
+  // Jump on the next pulse
+  if (state == TRANSPORT_PLAYING) {
+    state = TRANSPORT_ARMED;
+  }
+}
+
+bool Transport::pulse(uint8_t missed) {
+  if (state == TRANSPORT_STOPPED || state == TRANSPORT_FREE) {
+    return false;
+  }
+
+  // Playback starts on the first pulse that arrives after Start, whatever went missing
+  if (state == TRANSPORT_PLAYING) nextSongPulse += missed;
+  songPulse = nextSongPulse++;
+  if (state == TRANSPORT_ARMED) {
+    state = TRANSPORT_PLAYING;
+    return true;
+  }
+  return false;
+}
+
+bool Transport::refresh(Tick_t now) {
+  if (state == TRANSPORT_FREE || timebase.hasExternalClock()) {
+    return false;
+  }
+
+  // Without clock there's nothing to follow, but give the clock a chance to
+  // start after Start or Continue
+  if (state == TRANSPORT_ARMED && now - armedTick <= CLOCK_TIMEOUT * TICKS_PER_MS) {
+    return false;
+  }
+  state = TRANSPORT_FREE;
+  return true;
+}
+
+TransportState_t Transport::getState() { return state; }
+
+bool Transport::isStopped() { return state == TRANSPORT_STOPPED; }
+
+uint32_t Transport::getSongPulse() { return songPulse; }
@@ -0,0 +1,56 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "Globals.h"
+#include "Timebase.h"
+
+/* TRANSPORT STATES */
+typedef enum {
+  TRANSPORT_FREE,    // No transport, clocked effects just follow the clock
+  TRANSPORT_STOPPED, // Stopped, clocked effects are frozen
+  TRANSPORT_ARMED,   // Start or Continue received, playback starts on the next pulse
+  TRANSPORT_PLAYING,
+} TransportState_t;
+
+/* TRANSPORT EVENTS */
+// What the effects get told about
+typedef enum {
+  TRANSPORT_EVENT_PLAY, // Playback starts on this pulse, from getSongPulse()
+  TRANSPORT_EVENT_STOP, // Freeze
+  TRANSPORT_EVENT_FREE, // Back to following the clock without transport
+} TransportEvent_t;
+
+/* TRANSPORT CLASS */
+// Follows Start, Stop, Continue and Song Position from the clock source, and
+// counts where in the song each clock pulse is. Playback starts on the first
+// pulse after Start or Continue (as the midi spec says), so effects can line
+// up their steps with that pulse. Song Position moves where that is, and a
+// Song Position while playing jumps on the next pulse.
+// The methods return true when the effects need to be told about a change.
+class Transport {
+private:
+  TransportState_t state;
+  uint32_t songPulse; // Where in the song the last pulse was, in clock pulses
+  uint32_t nextSongPulse; // Where in the song the next pulse is
+  Tick_t armedTick; // When Start or Continue arrived
+
+  void arm(Tick_t now);
+
+public:
+  Transport();
+  void start(Tick_t now);
+  void resume(Tick_t now); // Continue
+  bool stop();
+  void setSongPosition(uint16_t beats); // Song Position, in 1/16 notes
+  bool pulse(uint8_t missed); // Call for every followed clock pulse, with the pulses missing before it, true if playback starts on it
+  bool refresh(Tick_t now); // Call every loop, true if it's gone back to free running
+
+  TransportState_t getState();
+  bool isStopped();
+  uint32_t getSongPulse();
+};
+/* END TRANSPORT CLASS */
+
+extern Transport transport;
+
+#endif // TRANSPORT_H
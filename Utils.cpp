@@ -1,4 +1,5 @@
 #include "Utils.h"
+#include "NoteTracker.h"
 
 void setLed(uint8_t r, uint8_t g, uint8_t b) {
   analogWrite(LED_R_PIN, r);
@@ -8,8 +9,16 @@ void setLed(uint8_t r, uint8_t g, uint8_t b) {
 
 void sendMidiBoth(midi::MidiType type, uint8_t note, uint8_t velocity,
                   uint8_t channel) {
+  // Waits for the end of a SysEx dump, and isn't sounding if it's dropped
+  if (sysExThru.isHolding()) {
+    if (sysExThru.defer(type, note, velocity, channel)) {
+      noteTracker.track(type, note, velocity, channel);
+    }
+    return;
+  }
   hardwareMIDI.send(type, note, velocity, channel);
   usbMIDI.send(type, note, velocity, channel);
+  noteTracker.track(type, note, velocity, channel);
 }
 
 void sendMidiClock() {
@@ -23,11 +32,50 @@ void sendMidiStart() {
 }
 
 void sendMidiStop() {
-  hardwareMIDI.sendContinue();
-  usbMIDI.sendContinue();
+  hardwareMIDI.sendStop();
+  usbMIDI.sendStop();
 }
 
 void sendMidiContinue() {
   hardwareMIDI.sendContinue();
   usbMIDI.sendContinue();
 }
+
+void sendMidiSongPosition(uint16_t beats) {
+  if (sysExThru.isHolding()) {
+    sysExThru.defer(midi::MidiType::SongPosition, beats & 0x7F, (beats >> 7) & 0x7F, 0);
+    return;
+  }
+  hardwareMIDI.sendSongPosition(beats);
+  usbMIDI.sendSongPosition(beats);
+}
+
+// Clock and transport messages are handled by the clock arbiter's handlers,
+// and SysEx by the SysEx handler, so effects should skip them when reading
+bool isRoutedMessage(midi::MidiType type) {
+  switch (type) {
+  case midi::MidiType::Clock:
+  case midi::MidiType::Start:
+  case midi::MidiType::Stop:
+  case midi::MidiType::Continue:
+  case midi::MidiType::SongPosition:
+  case midi::MidiType::ActiveSensing:
+  case midi::MidiType::SystemExclusive:
+    return true;
+  default:
+    return false;
+  }
+}
+
+uint8_t crc8(const uint8_t *data, uint8_t len) {
+  // CRC-8 with the 0x07 polynomial, bit by bit as it's only used when saving
+  // and loading
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
@@ -17,4 +17,10 @@ void sendMidiStop();
 
 void sendMidiContinue();
 
+void sendMidiSongPosition(uint16_t beats);
+
+bool isRoutedMessage(midi::MidiType type);
+
+uint8_t crc8(const uint8_t *data, uint8_t len);
+
 #endif // UTILS_H
\ No newline at end of file